@@ -7,6 +7,12 @@
  */
 
 #include "malloc.h"
+#include "checkheap.h"
+#include "config.h"
+#include "pressure.h"
+#include "probes.h"
+#include "sites.h"
+#include "tags.h"
 #include "thread_cache.h"
 
 #include <assert.h>
@@ -48,29 +54,29 @@
 
 #endif
 
-#define MAX_SEGLIST_SEARCH  15
 
-static bool mm_checkheap(int x) { return true; }
-
-/** Word and header size (bytes) */
-static const size_t wsize = sizeof(word_t);
-// 8B
+/* Global variables */
 
-/** Double word size (bytes) */
-static const size_t dsize = 2 * wsize;
-// 16B
+/* a thread-local cache for quick allocations */
+static __thread cache_t local_cache;
 
-/** Minimum block size (bytes) */
-static const size_t min_block_size = 2 * dsize;
-// 32B
+/* bytes this thread has allocated and freed so far. these only
+ * ever grow, and are only written by their own thread.
+ */
+static __thread uint64_t thread_allocated;
+static __thread uint64_t thread_deallocated;
 
-// 2048B, divisible by 16
-// when heap is full, extend heap by this much
+/* bumped by arena_cached_flush_caches(). a thread whose cache_epoch
+ * is behind it empties its cache before using it again.
+ */
+static unsigned flush_epoch;
+static __thread unsigned cache_epoch;
 
-/* Global variables */
+static void flush_cache(void);
 
-/* a thread-local cache for quick allocations */
-static __thread cache_t local_cache;
+static bool mm_checkheap(arena_t *arena, int line) {
+    return arena_checkheap(arena, line) && cache_check(&local_cache);
+}
 
 /** Pointer to first block in the heap */
 
@@ -140,6 +146,13 @@ static size_t round_up(size_t size, size_t n) {
 }
 
 
+/* size of the block that holds a payload of size bytes, header
+ * included. every allocation path sizes its blocks with this.
+ */
+static size_t adjusted_size(size_t size) {
+    return round_up(size + wsize, dsize);
+}
+
 /**
  * Given a payload pointer, returns a pointer to the corresponding
  *        block.
@@ -291,6 +304,22 @@ static void write_block(block_t *block, size_t size, bool alloc,
     }
 }
 
+/* updates the prev_alloc bit of a block, and leaves the rest of it
+ * alone. an allocated block's header can be written by its owner
+ * without the arena lock (see mark_sampled()), so both sides change
+ * their own bits atomically.
+ */
+static void write_prev_alloc(block_t *block, bool prev_alloc) {
+    if (!get_alloc(block)) {
+        write_block(block, get_size(block), false, prev_alloc);
+    } else if (prev_alloc) {
+        __atomic_fetch_or(&block->header, prev_alloc_mask, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&block->header, ~(word_t)prev_alloc_mask,
+                           __ATOMIC_RELAXED);
+    }
+}
+
 /**
  * Finds the next consecutive block on the heap.
  *
@@ -471,7 +500,43 @@ static block_t *coalesce_block(block_t *block, arena_t *arena) {
 
     assert(block != NULL);
     next = find_next(block);
-    write_block(next, get_size(next), get_alloc(next), false);
+    write_prev_alloc(next, false);
+
+    PM_PROBE3(coalesce, arena, block, get_size(block));
+    return block;
+}
+
+/*
+ * extends the arena's heap by size bytes, and returns the new free
+ * block, coalesced with the last block if that was free. returns NULL
+ * if the arena has no room left.
+ */
+static block_t *extend_arena_heap(arena_t *arena, size_t size,
+                                  bool prev_alloc) {
+    dbg_requires(size > 0);
+    void *bp;
+
+    size = round_up(size, dsize);
+    if ((bp = extend_arena(arena, size)) == NULL) {
+        return NULL;
+    }
+
+    block_t *block = payload_to_header(bp);
+    write_block(block, size, false,
+                prev_alloc); // not allocated, add to free list
+
+    // Create new epilogue header
+    block_t *block_next = find_next(block);
+
+    write_epilogue(block_next, false);
+
+    PM_PROBE2(arena_extend, arena, size);
+
+    // Coalesce in case the previous block was free
+    block = coalesce_block(block, arena);
+    add_to_free_list(block, arena);
+
+    dbg_ensures(block);
     return block;
 }
 
@@ -513,15 +578,12 @@ static void split_block(block_t *block, size_t asize, arena_t *arena) {
  */
 static size_t find_list_for_block(block_t *block) {
     dbg_requires(block);
-    // shift asize right to find list
-    // shift by 5 to min block size
-    size_t size = get_size(block) >> 6;
-    size_t list_ind = 0;
-    while (size != 0 && list_ind < MAXLISTS - 1) {
-        size >>= 1; // next power
-        list_ind++;
-    }
-    dbg_ensures(0 <= list_ind && list_ind <= MAXLISTS - 1);
+    size_t list_ind = size_to_class(get_size(block));
+    size_t maxlists = pm_config.maxlists;
+    if (list_ind > maxlists - 1) {
+        list_ind = maxlists - 1;
+    }
+    dbg_ensures(0 <= list_ind && list_ind <= maxlists - 1);
     return list_ind;
 }
 
@@ -541,6 +603,7 @@ static block_t *search_list(block_t *list_start, size_t asize) {
         return NULL;
     }
     size_t count = 0;
+    size_t max_search = pm_config.max_seglist_search;
     block_t *best_fit = NULL;
     size_t fit_error = asize;
     size_t block_size;
@@ -548,7 +611,7 @@ static block_t *search_list(block_t *list_start, size_t asize) {
          block = block->nextBlockInList) {
         count++;
 
-        if (!block || count > MAX_SEGLIST_SEARCH)
+        if (!block || count > max_search)
             break;
 
         block_size = get_size(block);
@@ -586,22 +649,16 @@ static block_t *search_list(block_t *list_start, size_t asize) {
  */
 static block_t *find_fit(size_t asize, arena_t *arena) {
     dbg_requires(asize > 0);
-    // asize a multiple of 16, min 32
     // get the smallest list it can have a fit
-    size_t size = asize >> 6; // 32 gives 0
-    size_t min_list_ind = 0;
-    while (size != 0) {
-        size >>= 1; // next power
-        min_list_ind++;
-    }
-
-    if (min_list_ind > MAXLISTS - 1) {
-        min_list_ind = MAXLISTS - 1;
+    size_t min_list_ind = size_to_class(asize);
+    size_t maxlists = pm_config.maxlists;
+    if (min_list_ind > maxlists - 1) {
+        min_list_ind = maxlists - 1;
     }
 
     // search each possible list
     for (int list_ind = min_list_ind;
-        list_ind < MAXLISTS &&
+        list_ind < maxlists &&
         list_ind <= min_list_ind + 1; list_ind++)
     {
         block_t *block = search_list(arena->seglists[list_ind], asize);
@@ -614,12 +671,28 @@ static block_t *find_fit(size_t asize, arena_t *arena) {
     return NULL;
 }
 
+/* for when the heap can't grow: every block in a list two or more
+ * classes up is big enough, so take the first one there. find_fit()
+ * doesn't look that far, which leaves a full arena (a persistent heap,
+ * say) unable to serve small requests from a large free block.
+ */
+static block_t *find_larger(size_t asize, arena_t *arena) {
+    size_t maxlists = pm_config.maxlists;
+    for (size_t list_ind = size_to_class(asize) + 2; list_ind < maxlists;
+         list_ind++) {
+        if (arena->seglists[list_ind])
+            return arena->seglists[list_ind];
+    }
+    return NULL;
+}
+
 void init_tcache(void) {
     cache_init(&local_cache);
 }
 
 bool arena_cached_malloc_init(void) {
-    arenas_init(10); /* replace with 2 * number of CPUs or something */
+    pm_config_init();
+    arenas_init(pm_config.num_arenas);
     return true;
 }
 
@@ -642,13 +715,13 @@ static void *_malloc(size_t size, arena_t *arena) {
     void *bp = NULL;
     // Ignore spurious request
     if (size == 0) {
-        dbg_ensures(mm_checkheap(__LINE__));
+        dbg_ensures(mm_checkheap(arena, __LINE__));
         return bp;
     }
 
     // Adjust block size to include overhead and to meet alignment
     // requirements
-    asize = round_up(size + wsize, dsize);
+    asize = adjusted_size(size);
 
     // Search the free list for a fit
     block = find_fit(asize, arena);
@@ -656,12 +729,20 @@ static void *_malloc(size_t size, arena_t *arena) {
     // If no fit is found, request more memory, and then and place the block
     if (block == NULL) {
         // Always request at least chunksize
-        extendsize = max(asize, CHUNK_SIZE);
+        extendsize = max(asize, pm_config.chunk_size);
+
+        bool prev_alloc = extract_prev_alloc(
+            *(word_t *)(mem_heap_hi(arena) - 7));
+        block = extend_arena_heap(arena, extendsize, prev_alloc);
 
-        block = extend_arena_heap(arena,
-            extendsize,
-            extract_prev_alloc(
-                *(word_t *)(mem_heap_hi(arena) - 7)));
+        // near the end of the arena, take only what is needed.
+        if (block == NULL && extendsize > asize) {
+            block = extend_arena_heap(arena, asize, prev_alloc);
+        }
+
+        if (block == NULL) {
+            block = find_larger(asize, arena);
+        }
 
         if (block == NULL) {
             return bp;
@@ -681,11 +762,82 @@ static void *_malloc(size_t size, arena_t *arena) {
 
     // Propoagate status to the next block
     block_t *next = find_next(block);
-    write_block(next, get_size(next), get_alloc(next), true);
+    write_prev_alloc(next, true);
     bp = header_to_payload(block);
+
+    arena_checkheap_tick(arena);
+    dbg_ensures(mm_checkheap(arena, __LINE__));
     return bp;
 }
 
+/* like _malloc(), for a payload aligned to align bytes, a power of
+ * two above dsize. the block is allocated big enough to hold an
+ * aligned payload wherever it lands, and the slack on either side of
+ * that payload is freed again.
+ */
+static void *_malloc_aligned(size_t size, size_t align, arena_t *arena) {
+    if (size > SIZE_MAX - align - min_block_size)
+        return NULL;
+
+    void *bp = _malloc(size + align + min_block_size, arena);
+    if (bp == NULL)
+        return NULL;
+
+    block_t *block = payload_to_header(bp);
+    if ((uintptr_t)bp & (align - 1)) {
+        /* leave room for a free block in front of the payload. */
+        uintptr_t aligned = ((uintptr_t)bp + min_block_size + align - 1)
+                            & ~(uintptr_t)(align - 1);
+        size_t lead = aligned - (uintptr_t)bp;
+        size_t block_size = get_size(block);
+
+        block_t *lead_block = block;
+        block = payload_to_header((void *)aligned);
+        write_block(block, block_size - lead, true, false);
+        write_block(lead_block, lead, false, get_prev_alloc(lead_block));
+        lead_block = coalesce_block(lead_block, arena);
+        add_to_free_list(lead_block, arena);
+    }
+
+    /* a free tail split off here has to be marked free in the next
+     * block's header, and may border on the free remainder _malloc()
+     * split off.
+     */
+    split_block(block, adjusted_size(size), arena);
+    block_t *next = find_next(block);
+    if (!get_alloc(next)) {
+        block_t *after = find_next(next);
+        write_prev_alloc(after, false);
+        delete_from_free_list(next, arena);
+        next = coalesce_block(next, arena);
+        add_to_free_list(next, arena);
+    }
+
+    dbg_ensures(mm_checkheap(arena, __LINE__));
+    return header_to_payload(block);
+}
+
+/* locks the arena at index in the arena table, or if index is -1,
+ * the next arena in turn from the pool for lifetime, mapping it first
+ * if need be. returns NULL if there is no such arena or it couldn't be
+ * mapped.
+ */
+static arena_t *lock_arena(int index, pm_lifetime_t lifetime) {
+    arena_t *arena = index < 0 ? get_lifetime_arena(lifetime)
+                               : get_arena_at(index);
+    if (!arena)
+        return NULL;
+
+    if (!arena->heap_start) {
+        assert(!arena->low);
+        if (!arena_map(arena)) {
+            release_arena(arena);
+            return NULL;
+        }
+    }
+    return arena;
+}
+
 /**
  *  *
  * <What does this function do?> Frees a block
@@ -732,92 +884,251 @@ static void *_calloc(size_t elements, size_t size) {
 /* thread safe wrappers with global lock.
  * naive version.
  */
-void *arena_cached_malloc(size_t size) {
+static void *cached_malloc(size_t size) {
+    if (__atomic_load_n(&flush_epoch, __ATOMIC_RELAXED) != cache_epoch)
+        flush_cache();
 
     /* first, query the thread-local cache. */
     
     block_t *block = cache_query(&local_cache, size);    
     if (block) {        
         /* if that found something, we're done. */
+        thread_allocated += get_size(block);
+        PM_PROBE2(cache_hit, size, block);
         return header_to_payload(block);    
     }
+    PM_PROBE1(cache_miss, size);
 
     /* otherwise, find an arena to use, grab a lock
      * on it, and then proceed.
      */
-    arena_t *arena = get_arena();
+    arena_t *arena = lock_arena(-1, PM_LIFETIME_DEFAULT);
+    if (!arena)
+        return NULL;
 
-    if (!arena->heap_start) {
-        assert(!arena->low);
-        arena->low = mmap(NULL, ARENA_MAX_SIZE, PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-        arena->size = ARENA_MAX_SIZE;
+    void *output = _malloc(size, arena);
 
-        if (arena->low == MAP_FAILED) {
-            arena->low = NULL;
-            release_arena(arena);
-            return NULL;
-        }
+    /* relinquish our ownership of this arena, allowing another
+     * thread to make use of it.
+     */
+    release_arena(arena);
 
-        word_t *start = (word_t *)arena->low;
-        start[0] = pack(0, true, true);
-        start[1] = pack(0, true, true);
+    if (output)
+        thread_allocated += get_size(payload_to_header(output));
+    return output;
+}
 
-        // Heap starts with first "block header", currently the epilogue
-        arena->heap_start = (block_t *)&(start[1]);
-        arena->heap_end = (void *)((char *)start + 2 * wsize);
+/* marks a block as a lifetime sample. other threads may be updating
+ * its prev_alloc bit at the same time, hence the atomics.
+ */
+static void mark_sampled(block_t *block) {
+    __atomic_fetch_or(&block->header, sampled_mask, __ATOMIC_RELAXED);
+}
 
-        if (extend_arena_heap(arena, CHUNK_SIZE, true) == NULL) {
-            assert(false && "arena initialization failed");
-        }
+/* records the calling thread's tag in a block on its way out of the
+ * allocator. the block's tag bits are clear until then.
+ */
+static void tag_block(block_t *block) {
+    pm_tag_t tag = pm_thread_tag;
+    if (tag) {
+        __atomic_fetch_or(&block->header, (word_t)tag << tag_shift,
+                          __ATOMIC_RELAXED);
+        tag_count_alloc(tag, get_size(block));
     }
+}
 
-    assert(arena && "there must always be a valid arena");
-    void *output = _malloc(size, arena);
+/* a block coming back to the allocator is no longer a sample, and
+ * no longer counts under its tag.
+ */
+static void untrack_block(block_t *block) {
+    word_t marks = (word_t)sampled_mask | tag_mask;
+    word_t header = __atomic_load_n(&block->header, __ATOMIC_RELAXED);
+    if (!(header & marks))
+        return;
 
-    /* relinquish our ownership of this arena, allowing another
-     * thread to make use of it.
-     */
-    release_arena(arena);
+    __atomic_fetch_and(&block->header, ~marks, __ATOMIC_RELAXED);
+    if (header & tag_mask)
+        tag_count_free(header >> tag_shift, extract_size(header));
+    if (header & sampled_mask)
+        site_sample_free(header_to_payload(block));
+}
+
+/* arena_cached_malloc() with lifetime prediction: allocations from a
+ * call site predicted to be long-lived go to the long-lived pool, and
+ * some allocations are sampled to keep the predictions up to date.
+ */
+static void *site_malloc(size_t size, void *caller, size_t interval) {
+    uint32_t site = site_key(caller, size);
+    void *output;
+
+    if (site_predicts_long(site)) {
+        arena_t *arena = lock_arena(-1, PM_LIFETIME_LONG);
+        if (!arena)
+            return NULL;
+        output = _malloc(size, arena);
+        release_arena(arena);
+        if (output)
+            thread_allocated += get_size(payload_to_header(output));
+    } else {
+        output = cached_malloc(size);
+    }
+
+    if (output && site_sample_due(interval) &&
+        site_sample_alloc(site, output))
+        mark_sampled(payload_to_header(output));
     return output;
 }
 
+void *arena_cached_malloc(size_t size) {
+    void *output;
+    size_t interval = __atomic_load_n(&pm_config.lifetime_sample_interval,
+                                      __ATOMIC_RELAXED);
+    if (interval)
+        output = site_malloc(size, __builtin_return_address(0), interval);
+    else
+        output = cached_malloc(size);
+
+    if (output)
+        tag_block(payload_to_header(output));
+    return output;
+}
+
+/* allocates up to n blocks of size bytes from one arena, taking its
+ * lock once. the thread cache is skipped, since it holds blocks of
+ * mixed sizes. returns how many were allocated, which is less than n
+ * only if the arena ran out of room.
+ */
+size_t arena_cached_malloc_batch(size_t size, void **ptrs, size_t n) {
+    arena_t *arena = lock_arena(-1, PM_LIFETIME_DEFAULT);
+    if (!arena)
+        return 0;
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        ptrs[i] = _malloc(size, arena);
+        if (!ptrs[i])
+            break;
+        thread_allocated += get_size(payload_to_header(ptrs[i]));
+    }
+
+    release_arena(arena);
+    return i;
+}
+
 /* actually frees a block. this is different from
  * just freeing, which might end up just inserting
  * to the cache.
  */
-void truly_free(block_t *block)
+static void free_block(block_t *block, arena_t *arena, bool keep)
 {
-    arena_t *arena = find_arena((void *)block);
     size_t size = get_size(block);
-    
+
+    dbg_requires(mm_checkheap(arena, __LINE__));
+
     // Mark the block as free
     write_block(block, size, false, get_prev_alloc(block));
     block_t *next = find_next(block);
-    write_block(next, get_size(next), get_alloc(next), false);
+    write_prev_alloc(next, false);
 
     // Try to coalesce the block with its neighbors
     block = coalesce_block(block, arena);
     add_to_free_list(block, arena);
 
+    /* small blocks only free up whole pages once merged. */
+    if (pm_pressure && !keep)
+        purge_free_block(block);
+
+    arena_checkheap_tick(arena);
+    dbg_ensures(mm_checkheap(arena, __LINE__));
+}
+
+static void free_to_arena(block_t *block, bool keep)
+{
+    arena_t *arena = find_arena((void *)block);
+    free_block(block, arena, keep);
     release_arena(arena);
 }
 
+void truly_free(block_t *block)
+{
+    free_to_arena(block, false);
+}
+
+static void flush_cache(void) {
+    cache_epoch = __atomic_load_n(&flush_epoch, __ATOMIC_RELAXED);
+    while (local_cache.num_entries > 0)
+        truly_free(cache_evict(&local_cache));
+}
+
+void arena_cached_flush_caches(void) {
+    __atomic_fetch_add(&flush_epoch, 1, __ATOMIC_RELAXED);
+}
+
+/* the freeing thread's share of a free: the bytes count as freed by
+ * this thread, and the block stops being a sample and loses its tag.
+ * the block itself stays allocated until arena_cached_free_batch().
+ */
+void arena_cached_release(void *ptr) {
+    block_t *block = payload_to_header(ptr);
+    thread_deallocated += get_size(block);
+    untrack_block(block);
+}
+
+/* frees n released blocks back to their arenas, taking each arena's
+ * lock once. the blocks are grouped by arena in ptrs as they go.
+ */
+void arena_cached_free_batch(void **ptrs, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        int index = arena_index(ptrs[done]);
+        arena_t *arena = get_arena_at(index);
+        assert(arena && "freeing a block outside the arenas");
+
+        for (size_t i = done; i < n; i++) {
+            if (arena_index(ptrs[i]) != index)
+                continue;
+            void *ptr = ptrs[i];
+            ptrs[i] = ptrs[done];
+            ptrs[done++] = ptr;
+            free_block(payload_to_header(ptr), arena, false);
+        }
+        release_arena(arena);
+    }
+}
+
 /* we try to insert the
  * block to the cache for reuse and 
  *try to take advantage of possible locality
  */
 
-void arena_cached_free(void *ptr) {
+static void cached_free(void *ptr, bool keep) {
     block_t *block = payload_to_header(ptr);
+    thread_deallocated += get_size(block);
+    untrack_block(block);
+
+    if (__atomic_load_n(&flush_epoch, __ATOMIC_RELAXED) != cache_epoch)
+        flush_cache();
+
+    /* under pressure the cache holds a block at most, and whatever it
+     * evicts is purged, so a block to be kept goes straight back.
+     */
+    if (keep && pm_pressure) {
+        free_to_arena(block, true);
+        return;
+    }
+
     if (cache_add(&local_cache, block))
         return;
     
     /* if we failed to insert it into the cache,
      * evict from the cache with some probability,
-     * which is currently fixed.
+     * which is currently fixed. a block too large
+     * for the cache may find it empty.
      */
-    if ((double)(rand() / RAND_MAX) < CACHE_EVICT_PROBABILITY) {
+    if (local_cache.num_entries > 0 &&
+        (double)rand() / RAND_MAX < pm_config.cache_evict_probability) {
         block_t *evict = cache_evict(&local_cache);   
+        PM_PROBE2(cache_evict, evict, get_size(evict));
         truly_free(evict);
 
         /* now try to put it into the cache one more time. */
@@ -829,5 +1140,162 @@ void arena_cached_free(void *ptr) {
     /* if the cache refused our request, then we
      * will free the block back to the arena.
      */
-    truly_free(block);
+    free_to_arena(block, keep);
+}
+
+void arena_cached_free(void *ptr) {
+    cached_free(ptr, false);
+}
+
+/* the fields of a pm_mallocx() flags word (see malloc.h). */
+static size_t mallocx_align(int flags) {
+    int lg_align = flags & PM_MALLOCX_LG_ALIGN_MASK;
+    return lg_align ? (size_t)1 << lg_align : 0;
+}
+
+static int mallocx_arena(int flags) {
+    return (flags >> PM_MALLOCX_ARENA_SHIFT) - 1;
+}
+
+static pm_lifetime_t mallocx_lifetime(int flags) {
+    return (flags >> PM_MALLOCX_LIFETIME_SHIFT) & (PM_NUM_LIFETIMES - 1);
+}
+
+void *pm_mallocx(size_t size, int flags) {
+    size_t align = mallocx_align(flags);
+    int index = mallocx_arena(flags);
+    pm_lifetime_t lifetime = mallocx_lifetime(flags);
+    void *output = NULL;
+
+    if (size == 0)
+        return NULL;
+
+    bool cached = align <= dsize && index < 0 &&
+                  !(flags & PM_MALLOCX_TCACHE_NONE) &&
+                  lifetime < PM_LIFETIME_LONG;
+    if (cached) {
+        output = cached_malloc(size);
+    } else {
+        arena_t *arena = lock_arena(index, lifetime);
+        if (!arena)
+            return NULL;
+
+        output = align > dsize ? _malloc_aligned(size, align, arena)
+                               : _malloc(size, arena);
+        release_arena(arena);
+
+        if (output)
+            thread_allocated += get_size(payload_to_header(output));
+    }
+
+    if (output)
+        tag_block(payload_to_header(output));
+    if (output && (flags & PM_MALLOCX_ZERO))
+        memset(output, 0, size);
+    return output;
+}
+
+void *pm_smallocx(size_t size, int flags, size_t *usable) {
+    void *output = pm_mallocx(size, flags);
+    if (output && usable)
+        *usable = get_payload_size(payload_to_header(output));
+    return output;
+}
+
+size_t pm_nallocx(size_t size, int flags) {
+    /* _malloc_aligned() asks _malloc() for align + min_block_size
+     * more than size, and then cuts the block it gets back to the
+     * size an unaligned allocation would have.
+     */
+    size_t align = mallocx_align(flags);
+    size_t extra = align > dsize ? align + min_block_size : 0;
+    if (size == 0 || size > SIZE_MAX - dsize - wsize - extra)
+        return 0;
+    return adjusted_size(size) - wsize;
+}
+
+void pm_freex(void *ptr, int flags) {
+    if (ptr == NULL)
+        return;
+
+    bool keep = flags & PM_MALLOCX_NO_PURGE;
+    if (flags & PM_MALLOCX_TCACHE_NONE) {
+        block_t *block = payload_to_header(ptr);
+        thread_deallocated += get_size(block);
+        untrack_block(block);
+        free_to_arena(block, keep);
+        return;
+    }
+    cached_free(ptr, keep);
+}
+
+size_t pm_thread_reserve(size_t bytes, size_t size_hint) {
+    size_t payload = pm_nallocx(size_hint, 0);
+    if (payload == 0)
+        return 0;
+
+    size_t asize = payload + wsize;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t reserved = 0;
+    void *ptrs[RESERVE_BATCH];
+
+    /* everything stays allocated until the end, or each batch would
+     * reuse the last one's memory. the blocks are chained through
+     * their first payload word.
+     */
+    void *held = NULL;
+    while (reserved < bytes) {
+        size_t want = min((bytes - reserved + asize - 1) / asize,
+                          RESERVE_BATCH);
+        size_t got = arena_cached_malloc_batch(size_hint, ptrs, want);
+
+        /* the headers were written by _malloc(), so only the payload
+         * can still be on pages nobody has touched.
+         */
+        for (size_t i = 0; i < got; i++) {
+            volatile char *mem = ptrs[i];
+            for (size_t offset = 0; offset < payload; offset += page)
+                mem[offset] = 0;
+            mem[payload - 1] = 0;
+
+            *(void **)ptrs[i] = held;
+            held = ptrs[i];
+            reserved += get_size(payload_to_header(ptrs[i]));
+        }
+        if (got < want)
+            break;
+    }
+
+    /* as many as fit go into the cache, the rest back to the arenas. */
+    size_t to_free = 0;
+    while (held) {
+        void *ptr = held;
+        held = *(void **)ptr;
+
+        arena_cached_release(ptr);
+        if (cache_add(&local_cache, payload_to_header(ptr)))
+            continue;
+        ptrs[to_free++] = ptr;
+        if (to_free == RESERVE_BATCH) {
+            arena_cached_free_batch(ptrs, to_free);
+            to_free = 0;
+        }
+    }
+    arena_cached_free_batch(ptrs, to_free);
+    return reserved;
+}
+
+
+/* pointers to the calling thread's allocated and freed byte counters.
+ * the pointers stay valid for the thread's lifetime, so they can be
+ * fetched once and then read directly, e.g. before and after handling
+ * a request, to attribute allocation volume to it. sizes are block
+ * sizes, so they include per-block overhead.
+ */
+uint64_t *pm_thread_allocatedp(void) {
+    return &thread_allocated;
+}
+
+uint64_t *pm_thread_deallocatedp(void) {
+    return &thread_deallocated;
 }
@@ -8,6 +8,9 @@
  */
 
 #include "malloc.h"
+#include "checkheap.h"
+#include "config.h"
+#include "probes.h"
 #include <assert.h>
 #include <inttypes.h>
 #include <stdbool.h>
@@ -48,27 +51,9 @@
 
 #endif
 
-#define MAX_SEGLIST_SEARCH  15
-
-static bool mm_checkheap(int x) { return true; }
-
-/** @brief Word and header size (bytes) */
-static const size_t wsize = sizeof(word_t);
-// 8B
-
-/** @brief Double word size (bytes) */
-static const size_t dsize = 2 * wsize;
-// 16B
-
-/** @brief Minimum block size (bytes) */
-static const size_t min_block_size = 2 * dsize;
-// 32B
-
-// 2048B, divisible by 16
-// when heap is full, extend heap by this much
-
-
-static const word_t size_mask = ~(word_t)0xF;
+static bool mm_checkheap(arena_t *arena, int line) {
+    return arena_checkheap(arena, line);
+}
 
 /* Global variables */
 
@@ -484,10 +469,18 @@ static block_t *coalesce_block(block_t *block, arena_t *arena) {
     assert(block != NULL);
     next = find_next(block);
     write_block(next, get_size(next), get_alloc(next), false);
+
+    PM_PROBE3(coalesce, arena, block, get_size(block));
     return block;
 }
 
-block_t *extend_arena_heap(arena_t *arena, size_t size, bool prev_alloc) {
+/*
+ * extends the arena's heap by size bytes, and returns the new free
+ * block, coalesced with the last block if that was free. returns NULL
+ * if the arena has no room left.
+ */
+static block_t *extend_arena_heap(arena_t *arena, size_t size,
+                                  bool prev_alloc) {
     dbg_requires(size > 0);
     void *bp;
 
@@ -505,6 +498,8 @@ block_t *extend_arena_heap(arena_t *arena, size_t size, bool prev_alloc) {
 
     write_epilogue(block_next, false);
 
+    PM_PROBE2(arena_extend, arena, size);
+
     // Coalesce in case the previous block was free
     block = coalesce_block(block, arena);
     add_to_free_list(block, arena);
@@ -554,15 +549,12 @@ static void split_block(block_t *block, size_t asize, arena_t *arena) {
  */
 static size_t find_list_for_block(block_t *block) {
     dbg_requires(block);
-    // shift asize right to find list
-    // shift by 5 to min block size
-    size_t size = get_size(block) >> 6;
-    size_t list_ind = 0;
-    while (size != 0 && list_ind < MAXLISTS - 1) {
-        size >>= 1; // next power
-        list_ind++;
+    size_t list_ind = size_to_class(get_size(block));
+    size_t maxlists = pm_config.maxlists;
+    if (list_ind > maxlists - 1) {
+        list_ind = maxlists - 1;
     }
-    dbg_ensures(0 <= list_ind && list_ind <= MAXLISTS - 1);
+    dbg_ensures(0 <= list_ind && list_ind <= maxlists - 1);
     return list_ind;
 }
 
@@ -583,6 +575,7 @@ static block_t *search_list(block_t *list_start, size_t asize) {
         return NULL;
     }
     size_t count = 0;
+    size_t max_search = pm_config.max_seglist_search;
     block_t *best_fit = NULL;
     size_t fit_error = asize;
     size_t block_size;
@@ -590,7 +583,7 @@ static block_t *search_list(block_t *list_start, size_t asize) {
          block = block->nextBlockInList) {
         count++;
 
-        if (!block || count > MAX_SEGLIST_SEARCH)
+        if (!block || count > max_search)
             break;
 
         block_size = get_size(block);
@@ -629,22 +622,16 @@ static block_t *search_list(block_t *list_start, size_t asize) {
  */
 static block_t *find_fit(size_t asize, arena_t *arena) {
     dbg_requires(asize > 0);
-    // asize a multiple of 16, min 32
     // get the smallest list it can have a fit
-    size_t size = asize >> 6; // 32 gives 0
-    size_t min_list_ind = 0;
-    while (size != 0) {
-        size >>= 1; // next power
-        min_list_ind++;
-    }
-
-    if (min_list_ind > MAXLISTS - 1) {
-        min_list_ind = MAXLISTS - 1;
+    size_t min_list_ind = size_to_class(asize);
+    size_t maxlists = pm_config.maxlists;
+    if (min_list_ind > maxlists - 1) {
+        min_list_ind = maxlists - 1;
     }
 
     // search each possible list
     for (int list_ind = min_list_ind;
-        list_ind < MAXLISTS &&
+        list_ind < maxlists &&
         list_ind <= min_list_ind + 1; list_ind++)
     {
         block_t *block = search_list(arena->seglists[list_ind], asize);
@@ -657,8 +644,24 @@ static block_t *find_fit(size_t asize, arena_t *arena) {
     return NULL;
 }
 
+/* for when the heap can't grow: every block in a list two or more
+ * classes up is big enough, so take the first one there. find_fit()
+ * doesn't look that far, which leaves a full arena (a persistent heap,
+ * say) unable to serve small requests from a large free block.
+ */
+static block_t *find_larger(size_t asize, arena_t *arena) {
+    size_t maxlists = pm_config.maxlists;
+    for (size_t list_ind = size_to_class(asize) + 2; list_ind < maxlists;
+         list_ind++) {
+        if (arena->seglists[list_ind])
+            return arena->seglists[list_ind];
+    }
+    return NULL;
+}
+
 bool arena_malloc_init(void) {
-    arenas_init(10); // replace with 2 * number of CPUs or something
+    pm_config_init();
+    arenas_init(pm_config.num_arenas);
     return true;
 }
 
@@ -682,7 +685,7 @@ static void *_malloc(size_t size, arena_t *arena) {
     void *bp = NULL;
     // Ignore spurious request
     if (size == 0) {
-        dbg_ensures(mm_checkheap(__LINE__));
+        dbg_ensures(mm_checkheap(arena, __LINE__));
         return bp;
     }
 
@@ -696,12 +699,20 @@ static void *_malloc(size_t size, arena_t *arena) {
     // If no fit is found, request more memory, and then and place the block
     if (block == NULL) {
         // Always request at least chunksize
-        extendsize = max(asize, CHUNK_SIZE);
+        extendsize = max(asize, pm_config.chunk_size);
 
-        block = extend_arena_heap(arena,
-            extendsize,
-            extract_prev_alloc(
-                *(word_t *)(mem_heap_hi(arena) - 7)));
+        bool prev_alloc = extract_prev_alloc(
+            *(word_t *)(mem_heap_hi(arena) - 7));
+        block = extend_arena_heap(arena, extendsize, prev_alloc);
+
+        // near the end of the arena, take only what is needed.
+        if (block == NULL && extendsize > asize) {
+            block = extend_arena_heap(arena, asize, prev_alloc);
+        }
+
+        if (block == NULL) {
+            block = find_larger(asize, arena);
+        }
 
         if (block == NULL) {
             return bp;
@@ -723,6 +734,9 @@ static void *_malloc(size_t size, arena_t *arena) {
     block_t *next = find_next(block);
     write_block(next, get_size(next), get_alloc(next), true);
     bp = header_to_payload(block);
+
+    arena_checkheap_tick(arena);
+    dbg_ensures(mm_checkheap(arena, __LINE__));
     return bp;
 }
 
@@ -739,7 +753,7 @@ static void *_malloc(size_t size, arena_t *arena) {
 static void _free(void *bp, arena_t *arena) {
     dbg_requires(bp);
 
-    dbg_requires(mm_checkheap(__LINE__));
+    dbg_requires(mm_checkheap(arena, __LINE__));
 
     if (bp == NULL) {
         return;
@@ -760,7 +774,8 @@ static void _free(void *bp, arena_t *arena) {
     block = coalesce_block(block, arena);
     add_to_free_list(block, arena);
 
-    dbg_ensures(mm_checkheap(__LINE__));
+    arena_checkheap_tick(arena);
+    dbg_ensures(mm_checkheap(arena, __LINE__));
 }
 
 /**
@@ -805,26 +820,10 @@ void *arena_malloc(size_t size) {
 
     if (!arena->heap_start) {
         assert(!arena->low);
-        arena->low = mmap(NULL, ARENA_MAX_SIZE, PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-        arena->size = ARENA_MAX_SIZE;
-
-        if (arena->low == MAP_FAILED) {
-            arena->low = NULL;
+        if (!arena_map(arena)) {
             release_arena(arena);
             return NULL;
         }
-
-        word_t *start = (word_t *)arena->low;
-        start[0] = pack(0, true, true);
-        start[1] = pack(0, true, true);
-
-        // Heap starts with first "block header", currently the epilogue
-        arena->heap_start = (block_t *)&(start[1]);
-        arena->heap_end = (void *)((char *)start + 2 * wsize);
-
-        if (extend_arena_heap(arena, CHUNK_SIZE, true) == NULL) {
-            assert(false && "arena initialization failed");
-        }
     }
 
     assert(arena && "there must always be a valid arena");
@@ -844,3 +843,44 @@ void arena_free(void *ptr) {
     _free(ptr, arena);
     release_arena(arena);
 }
+
+// precondition: lock on arena is already held
+void *arena_malloc_in(arena_t *arena, size_t size) {
+    return _malloc(size, arena);
+}
+
+// precondition: lock on arena is already held
+void arena_free_in(arena_t *arena, void *ptr) {
+    if (ptr != NULL)
+        _free(ptr, arena);
+}
+
+// precondition: lock on arena is already held, or nothing
+// else can see the arena yet.
+bool arena_recover(arena_t *arena) {
+    word_t *start = (word_t *)arena->low;
+    char *limit = (char *)arena->low + arena->size;
+
+    if (start[0] != pack(0, true, true))
+        return false;
+    arena->heap_start = (block_t *)&start[1];
+
+    block_t *block = arena->heap_start;
+    while (get_size(block) != 0) {
+        size_t size = get_size(block);
+        if (size < min_block_size || (char *)block + size + wsize > limit)
+            return false;
+        block = find_next(block);
+    }
+    arena->heap_end = (char *)block + wsize;
+
+    memset(arena->seglists, 0, sizeof(arena->seglists));
+    for (block = arena->heap_start; get_size(block) != 0;
+         block = find_next(block)) {
+        if (!get_alloc(block))
+            add_to_free_list(block, arena);
+    }
+    arena->check_ticks = 0;
+    arena->check_list = 0;
+    return arena_checkheap(arena, __LINE__);
+}
@@ -1,49 +1,194 @@
 #include "malloc.h"
+#include "config.h"
+#include "probes.h"
+#include "pressure.h"
+#include "provision.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stddef.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* older libc headers don't know about anonymous VMA names
+ * (added in Linux 5.17), so fall back to the raw values.
+ */
+#ifndef PR_SET_VMA
+#define PR_SET_VMA  0x53564d41
+#define PR_SET_VMA_ANON_NAME  0
+#endif
 
 static arena_t *arenas = NULL;
 static int max_arenas = 0;
 
 static pthread_mutex_t arena_lock;
-static int last_used = 0;
+
+/* the arena table is split into pools by lifetime: the shared arenas
+ * come first, then lifetime_arenas for long-lived blocks, then as many
+ * for permanent ones. each pool hands out its arenas in turn.
+ */
+static int pool_first[PM_NUM_LIFETIMES];
+static int pool_size[PM_NUM_LIFETIMES];
+static int pool_next[PM_NUM_LIFETIMES];
+
+/* labels an anonymous mapping so that it shows up as
+ * [anon:<name>] in /proc/<pid>/maps and smaps. kernels without
+ * CONFIG_ANON_VMA_NAME reject this with EINVAL, in which case
+ * the mapping simply stays unnamed.
+ */
+void name_mapping(void *addr, size_t length, const char *name) {
+    prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME,
+          (unsigned long)addr, length, (unsigned long)name);
+}
+
+/* mmap()'s a fresh anonymous region and names it. every mapping
+ * the allocator makes should go through here, so that its memory
+ * can be told apart from the rest of the process.
+ * returns NULL (not MAP_FAILED) on failure.
+ */
+void *map_region(size_t length, const char *name) {
+    void *region = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (region == MAP_FAILED)
+        return NULL;
+
+    name_mapping(region, length, name);
+    return region;
+}
+
+/* older libc headers don't have it (added in Linux 5.14). */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE  23
+#endif
+
+void prefault_region(void *addr, size_t length) {
+    if (madvise(addr, length, MADV_POPULATE_WRITE) == 0 || errno != EINVAL)
+        return;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < length; offset += page)
+        ((volatile char *)addr)[offset] = 0;
+}
+
+/* madvise()s away the whole pages in [start, end). */
+static size_t purge_range(char *start, char *end) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    start = (char *)(((uintptr_t)start + page - 1) & ~(page - 1));
+    end = (char *)((uintptr_t)end & ~(page - 1));
+    if (start >= end || madvise(start, end - start, MADV_DONTNEED) != 0)
+        return 0;
+    return end - start;
+}
+
+size_t purge_free_block(block_t *block) {
+    char *start = (char *)block + sizeof(block_t);
+    char *end = (char *)block + get_size(block) - wsize;
+    return purge_range(start, end);
+}
+
+size_t arena_purge(arena_t *arena) {
+    size_t purged = 0;
+    for (int i = 0; i < SEGLIST_CAPACITY; i++) {
+        for (block_t *block = arena->seglists[i]; block;
+             block = block->nextBlockInList)
+            purged += purge_free_block(block);
+    }
+    /* heap_end is one past the epilogue, which stays. most of what
+     * lies past it was never touched, so it isn't counted.
+     */
+    purge_range(arena->heap_end, (char *)arena->low + arena->size);
+    return purged;
+}
+
+// lays out an empty heap at the start of [mem, mem + size): a
+// prologue and an epilogue with nothing in between. the first
+// allocation extends it. mem must be 16-byte aligned.
+void arena_format(arena_t *arena, void *mem, size_t size) {
+    arena->low = mem;
+    arena->size = size;
+
+    word_t *start = (word_t *)arena->low;
+    start[0] = pack(0, true, true);
+    start[1] = pack(0, true, true);
+
+    // Heap starts with first "block header", currently the epilogue
+    arena->heap_start = (block_t *)&(start[1]);
+    arena->heap_end = (void *)((char *)start + 2 * sizeof(uint64_t));
+
+    memset(arena->seglists, 0, sizeof(arena->seglists));
+    arena->check_ticks = 0;
+    arena->check_list = 0;
+}
+
+// precondition: the arena has not been mapped yet, and
+// is either being set up by arenas_init() or is locked.
+bool arena_map(arena_t *arena) {
+    char name[32];
+    snprintf(name, sizeof(name), "pmalloc:arena:%d", (int)(arena - arenas));
+
+    void *mem = map_region(pm_config.arena_max_size, name);
+    if (mem == NULL)
+        return false;
+
+    /* before the prologue is written: prefault_region() may store
+     * zeros.
+     */
+    size_t prefault = pm_config.arena_prefault;
+    if (prefault > pm_config.arena_max_size)
+        prefault = pm_config.arena_max_size;
+    if (prefault)
+        prefault_region(mem, prefault);
+
+    arena_format(arena, mem, pm_config.arena_max_size);
+    return true;
+}
 
 void arenas_init(int num_arenas) {
 
+    pm_config_init();
     pthread_mutex_init(&arena_lock, NULL);
 
     assert(num_arenas > 0);
     max_arenas = num_arenas;
 
     size_t bytes = max_arenas * sizeof(arena_t);
-    arenas = mmap(NULL, bytes, PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    assert(arenas != MAP_FAILED && "failed to create arena buffer");
+    arenas = map_region(bytes, "pmalloc:arena_table");
+    assert(arenas != NULL && "failed to create arena buffer");
 
     for (int i = 0; i < max_arenas; i++) {
         pthread_mutex_init(&arenas[i].lock, NULL);
-        arena_t *arena = &arenas[i];
-        arena->low = mmap(NULL, ARENA_MAX_SIZE, PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-        arena->size = ARENA_MAX_SIZE;
+        if (!arena_map(&arenas[i])) {
+            assert(false && "failed to map arena");
+        }
+    }
 
-        assert(arena->low != MAP_FAILED);
+    /* too few arenas to set any aside leaves every pool shared. */
+    int set_aside = pm_config.lifetime_arenas;
+    if (2 * set_aside >= max_arenas)
+        set_aside = 0;
 
-        word_t *start = (word_t *)arena->low;
-        start[0] = pack(0, true, true);
-        start[1] = pack(0, true, true);
+    int shared = max_arenas - 2 * set_aside;
+    for (int l = 0; l < PM_NUM_LIFETIMES; l++) {
+        pool_first[l] = 0;
+        pool_size[l] = shared;
+    }
+    if (set_aside > 0) {
+        pool_first[PM_LIFETIME_LONG] = shared;
+        pool_size[PM_LIFETIME_LONG] = set_aside;
+        pool_first[PM_LIFETIME_PERMANENT] = shared + set_aside;
+        pool_size[PM_LIFETIME_PERMANENT] = set_aside;
+    }
 
-        // Heap starts with first "block header", currently the epilogue
-        arena->heap_start = (block_t *)&(start[1]);
-        arena->heap_end = (void *)((char *)start + 2 * sizeof(uint64_t));
+    /* the arenas are laid out now, so their shape is fixed. */
+    pm_config_freeze();
 
-        if (extend_arena_heap(arena, CHUNK_SIZE, true) == NULL) {
-            assert(false && "arena initialization failed");
-        }
-    }
+    provision_start();
+    pressure_start();
 }
 
 // precondition: lock on arena is already held
@@ -63,11 +208,28 @@ void *extend_arena(arena_t *arena, size_t length) {
 // fetches an available arena, or waits for one
 // to open up.
 arena_t *get_arena(void) {
+    return get_lifetime_arena(PM_LIFETIME_DEFAULT);
+}
+
+// same, from the pool of arenas for the given lifetime.
+arena_t *get_lifetime_arena(pm_lifetime_t lifetime) {
     assert(max_arenas > 0);
 
-    arena_t *chosen_arena = NULL;
-    int index = __atomic_fetch_add(&last_used, 1, __ATOMIC_SEQ_CST) % max_arenas;
+    int turn = __atomic_fetch_add(&pool_next[lifetime], 1, __ATOMIC_SEQ_CST);
+    int index = pool_first[lifetime] + turn % pool_size[lifetime];
+    pthread_mutex_lock(&arenas[index].lock);
+    PM_PROBE1(arena_acquire, &arenas[index]);
+    return &arenas[index];
+}
+
+// locks and returns the arena at the given index of the
+// arena table, or NULL if there is no such arena.
+arena_t *get_arena_at(int index) {
+    if (index < 0 || index >= max_arenas)
+        return NULL;
+
     pthread_mutex_lock(&arenas[index].lock);
+    PM_PROBE1(arena_acquire, &arenas[index]);
     return &arenas[index];
 }
 
@@ -77,6 +239,7 @@ arena_t *find_arena(void *address) {
     for (int i = 0; i < max_arenas; i++) {
         if (address >= arenas[i].heap_start && address <= arenas[i].heap_end) {
             pthread_mutex_lock(&arenas[i].lock);
+            PM_PROBE1(arena_acquire, &arenas[i]);
             return &arenas[i];
         }
     }
@@ -84,5 +247,83 @@ arena_t *find_arena(void *address) {
 }
 
 void release_arena(arena_t *arena) {
+    PM_PROBE1(arena_release, arena);
     pthread_mutex_unlock(&arena->lock);
 }
+
+// returns the index of the arena whose mapping holds the given
+// address, or -1. nothing is locked: arenas never move once mapped.
+int arena_index(void *address) {
+    for (int i = 0; i < max_arenas; i++) {
+        if ((char *)address >= (char *)arenas[i].low &&
+            (char *)address < (char *)arenas[i].low + arenas[i].size)
+            return i;
+    }
+    return -1;
+}
+
+int arena_count(void) {
+    return max_arenas;
+}
+
+// returns the arena at the given index without locking it.
+// only for code that can't block, and only reads the arena.
+arena_t *arena_at(int index) {
+    if (index < 0 || index >= max_arenas)
+        return NULL;
+    return &arenas[index];
+}
+
+/* parses a "Key:   1234 kB" line from smaps. returns
+ * the value in bytes, or 0 if the line doesn't match.
+ */
+static size_t smaps_field(const char *line, const char *key) {
+    size_t len = strlen(key);
+    if (strncmp(line, key, len) != 0 || line[len] != ':')
+        return 0;
+
+    unsigned long kb = 0;
+    sscanf(line + len + 1, "%lu", &kb);
+    return (size_t)kb << 10;
+}
+
+/* reports how much of the given arena is actually backed by memory,
+ * by summing every smaps entry that overlaps the arena's mapping.
+ * this reads and parses a procfs file, so it is meant for monitoring,
+ * not for anything on the allocation path.
+ * note: if the kernel can't name mappings, neighbouring anonymous
+ * mappings may be merged with the arena, and get counted with it.
+ */
+bool arena_rss(int index, arena_rss_t *rss) {
+    if (index < 0 || index >= max_arenas || !arenas[index].low)
+        return false;
+
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (!smaps)
+        return false;
+
+    uintptr_t lo = (uintptr_t)arenas[index].low;
+    uintptr_t hi = lo + arenas[index].size;
+    bool inside = false;
+    char line[256];
+
+    memset(rss, 0, sizeof(*rss));
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            /* a new mapping starts here. */
+            inside = start < hi && end > lo;
+            continue;
+        }
+        if (!inside)
+            continue;
+
+        rss->resident += smaps_field(line, "Rss");
+        rss->dirty += smaps_field(line, "Private_Dirty");
+        rss->dirty += smaps_field(line, "Shared_Dirty");
+        rss->swapped += smaps_field(line, "Swap");
+    }
+
+    fclose(smaps);
+    return true;
+}
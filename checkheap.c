@@ -0,0 +1,235 @@
+/**
+ * @file checkheap.c
+ * @brief heap consistency checker for the arena allocators
+ *
+ * The full checker walks an arena's implicit list from heap_start to
+ * the epilogue, and then every seglist, verifying that:
+ *  - every block lies inside the heap and is properly aligned,
+ *  - free blocks have a footer that agrees with their header,
+ *  - each block's prev_alloc bit matches the previous block,
+ *  - no two free blocks are adjacent (coalescing is complete),
+ *  - every seglist entry is free, belongs to that list's size class,
+ *    is doubly linked properly, and every free block is in a list.
+ *
+ * The sampled checker only looks at a few free blocks from one seglist
+ * (rotating between lists on each run) and at their immediate
+ * neighbours, which is cheap enough to leave on in canary deployments.
+ *
+ * Nothing here modifies the heap.
+ */
+
+#include "checkheap.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* upper bound on the number of threads arenas_checkheap() uses. */
+#define CHECKHEAP_MAX_THREADS  8
+
+static bool report(int line, arena_t *arena, block_t *block, const char *msg) {
+    fprintf(stderr, "checkheap (line %d): arena %p, block %p: %s\n",
+            line, (void *)arena, (void *)block, msg);
+    return false;
+}
+
+static bool is_alloc(block_t *block) {
+    return block->header & alloc_mask;
+}
+
+static bool is_prev_alloc(block_t *block) {
+    return block->header & prev_alloc_mask;
+}
+
+static word_t *footer_of(block_t *block) {
+    return (word_t *)((char *)block + get_size(block) - wsize);
+}
+
+static block_t *next_block(block_t *block) {
+    return (block_t *)((char *)block + get_size(block));
+}
+
+static bool in_heap(arena_t *arena, block_t *block) {
+    return (void *)block >= arena->heap_start &&
+           (char *)block + wsize <= (char *)arena->heap_end;
+}
+
+/* must agree with find_list_for_block() in the allocators. */
+static size_t list_for_size(size_t size) {
+    size_t list_ind = size_to_class(size);
+    if (list_ind > pm_config.maxlists - 1)
+        list_ind = pm_config.maxlists - 1;
+    return list_ind;
+}
+
+/* checks the invariants that only depend on the block itself. */
+static bool check_block(arena_t *arena, block_t *block, int line) {
+    size_t size = get_size(block);
+
+    if (((uintptr_t)block->payload & (dsize - 1)) != 0)
+        return report(line, arena, block, "payload is not 16-byte aligned");
+    if (size < min_block_size)
+        return report(line, arena, block, "block is smaller than the minimum");
+    if ((char *)block + size > (char *)arena->heap_end - wsize)
+        return report(line, arena, block, "block runs past the epilogue");
+    if (!is_alloc(block) && *footer_of(block) != block->header)
+        return report(line, arena, block, "header and footer disagree");
+    if (!is_alloc(block) && (block->header & (sampled_mask | tag_mask)))
+        return report(line, arena, block, "free block is sampled or tagged");
+    return true;
+}
+
+/* checks a free block's seglist links against the list it was found in. */
+static bool check_list_entry(arena_t *arena, block_t *block, size_t list_ind,
+                             block_t *prev, int line) {
+    if (!in_heap(arena, block))
+        return report(line, arena, block, "seglist entry outside the heap");
+    if (is_alloc(block))
+        return report(line, arena, block, "allocated block in a seglist");
+    if (list_for_size(get_size(block)) != list_ind)
+        return report(line, arena, block, "block is in the wrong seglist");
+    if (block->prevBlockInList != prev)
+        return report(line, arena, block, "broken seglist back link");
+    return true;
+}
+
+bool arena_checkheap(arena_t *arena, int line) {
+    if (!arena->heap_start)
+        return true;
+
+    word_t prologue = *((word_t *)arena->heap_start - 1);
+    if (extract_size(prologue) != 0 || !(prologue & alloc_mask))
+        return report(line, arena, arena->heap_start, "bad prologue");
+
+    size_t free_blocks = 0;
+    bool prev_alloc = true;
+    block_t *block;
+    for (block = arena->heap_start; get_size(block) != 0;
+         block = next_block(block)) {
+        if (!check_block(arena, block, line))
+            return false;
+        if (is_prev_alloc(block) != prev_alloc)
+            return report(line, arena, block, "prev_alloc bit is wrong");
+        if (!prev_alloc && !is_alloc(block))
+            return report(line, arena, block, "two adjacent free blocks");
+
+        prev_alloc = is_alloc(block);
+        if (!prev_alloc)
+            free_blocks++;
+    }
+
+    /* the walk must end exactly at the epilogue. */
+    if ((char *)block != (char *)arena->heap_end - wsize || !is_alloc(block))
+        return report(line, arena, block, "bad epilogue");
+    if (is_prev_alloc(block) != prev_alloc)
+        return report(line, arena, block, "epilogue prev_alloc bit is wrong");
+
+    size_t listed = 0;
+    for (size_t i = 0; i < SEGLIST_CAPACITY; i++) {
+        block_t *prev = NULL;
+        for (block = arena->seglists[i]; block != NULL;
+             block = block->nextBlockInList) {
+            /* more entries than free blocks means a cycle. */
+            if (++listed > free_blocks)
+                return report(line, arena, block, "seglists hold too many blocks");
+            if (!check_list_entry(arena, block, i, prev, line))
+                return false;
+            prev = block;
+        }
+    }
+
+    if (listed != free_blocks)
+        return report(line, arena, NULL, "free block missing from seglists");
+    return true;
+}
+
+bool arena_checkheap_sampled(arena_t *arena, size_t budget, int line) {
+    if (!arena->heap_start)
+        return true;
+
+    size_t list_ind = arena->check_list++ % pm_config.maxlists;
+    block_t *prev = NULL;
+    block_t *block = arena->seglists[list_ind];
+
+    for (size_t n = 0; block != NULL && n < budget;
+         n++, prev = block, block = block->nextBlockInList) {
+        if (!check_list_entry(arena, block, list_ind, prev, line) ||
+            !check_block(arena, block, line))
+            return false;
+
+        /* coalescing should have merged this with any free neighbour. */
+        if (!is_prev_alloc(block))
+            return report(line, arena, block, "two adjacent free blocks");
+
+        block_t *next = next_block(block);
+        if (get_size(next) != 0 && !check_block(arena, next, line))
+            return false;
+        if (!is_alloc(next))
+            return report(line, arena, next, "two adjacent free blocks");
+        if (is_prev_alloc(next))
+            return report(line, arena, next, "prev_alloc bit is wrong");
+    }
+    return true;
+}
+
+#ifdef CHECKHEAP_SAMPLE
+void arena_checkheap_tick(arena_t *arena) {
+    if (++arena->check_ticks < CHECKHEAP_SAMPLE)
+        return;
+
+    arena->check_ticks = 0;
+    if (!arena_checkheap_sampled(arena, CHECKHEAP_SAMPLE_BUDGET, __LINE__))
+        abort();
+}
+#endif
+
+struct check_job {
+    int line;
+    int next_arena;
+    bool ok;
+};
+
+/* each worker keeps claiming arenas until there are none left. */
+static void *check_worker(void *arg) {
+    struct check_job *job = arg;
+    int index;
+
+    while ((index = __atomic_fetch_add(&job->next_arena, 1, __ATOMIC_RELAXED))
+           < arena_count()) {
+        arena_t *arena = get_arena_at(index);
+        bool ok = arena_checkheap(arena, job->line);
+        release_arena(arena);
+
+        if (!ok)
+            __atomic_store_n(&job->ok, false, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+bool arenas_checkheap(int line) {
+    struct check_job job = { .line = line, .next_arena = 0, .ok = true };
+    pthread_t threads[CHECKHEAP_MAX_THREADS];
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = arena_count();
+    if (num_threads > cpus)
+        num_threads = cpus;
+    if (num_threads > CHECKHEAP_MAX_THREADS)
+        num_threads = CHECKHEAP_MAX_THREADS;
+
+    /* the calling thread always takes part, so spawning can fail safely. */
+    int spawned = 0;
+    while (spawned < num_threads - 1 &&
+           pthread_create(&threads[spawned], NULL, check_worker, &job) == 0)
+        spawned++;
+
+    check_worker(&job);
+    for (int i = 0; i < spawned; i++)
+        pthread_join(threads[i], NULL);
+
+    if (!job.ok)
+        fprintf(stderr, "checkheap (line %d): heap is inconsistent\n", line);
+    return job.ok;
+}
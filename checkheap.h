@@ -0,0 +1,37 @@
+/* heap consistency checker for the arena allocators. */
+
+#ifndef CHECKHEAP_H_
+#define CHECKHEAP_H_
+
+#include "malloc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* number of free blocks the sampled checker looks at per run. */
+#define CHECKHEAP_SAMPLE_BUDGET  16
+
+/* full check of one arena. the caller must hold the arena lock. */
+bool arena_checkheap(arena_t *arena, int line);
+
+/* cheap check of a small, rotating slice of one arena.
+ * the caller must hold the arena lock.
+ */
+bool arena_checkheap_sampled(arena_t *arena, size_t budget, int line);
+
+/* full check of every arena, several arenas at a time. the caller
+ * must not hold any arena lock.
+ */
+bool arenas_checkheap(int line);
+
+/* canary builds (compiled with -D CHECKHEAP_SAMPLE=<period>) run the
+ * sampled checker once every <period> operations on an arena, and
+ * abort() on the first inconsistency. otherwise this is a no-op.
+ */
+#ifdef CHECKHEAP_SAMPLE
+void arena_checkheap_tick(arena_t *arena);
+#else
+static inline void arena_checkheap_tick(arena_t *arena) { (void)arena; }
+#endif
+
+#endif
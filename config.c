@@ -0,0 +1,233 @@
+/**
+ * @file config.c
+ * @brief runtime tunables for the parallel malloc implementation
+ *
+ * Each tunable is described by an entry in conf_entries, which gives
+ * its name, its type, where it lives in pm_config, the range of legal
+ * values, and whether it may still change once the arenas exist.
+ * Both the PMALLOC_CONF parser and pm_ctl() go through the same table,
+ * so a tunable only has to be added in one place.
+ */
+
+#include "config.h"
+#include "malloc.h"
+#include "thread_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+pm_config_t pm_config = {
+    .cache_max_entries = CACHE_MAX_ENTRIES,
+    .cache_max_size = CACHE_MAX_SIZE,
+    .cache_evict_probability = CACHE_EVICT_PROBABILITY,
+    .maxlists = MAXLISTS,
+    .max_seglist_search = MAX_SEGLIST_SEARCH,
+    .chunk_size = CHUNK_SIZE,
+    .arena_max_size = ARENA_MAX_SIZE,
+    .num_arenas = NUM_ARENAS,
+    .lifetime_arenas = LIFETIME_ARENAS,
+    .lifetime_sample_interval = LIFETIME_SAMPLE_INTERVAL,
+    .provision_headroom = PROVISION_HEADROOM,
+    .arena_prefault = ARENA_PREFAULT,
+    .pressure_interval_ms = PRESSURE_INTERVAL_MS,
+    .pressure_psi_threshold = PRESSURE_PSI_THRESHOLD,
+    .pressure_limit_ratio = PRESSURE_LIMIT_RATIO
+};
+
+typedef enum conf_type {
+    CONF_SIZE,
+    CONF_INT,
+    CONF_FLOAT
+} conf_type_t;
+
+typedef struct conf_entry {
+    const char *name;
+    conf_type_t type;
+    size_t offset;
+
+    /* legal range, inclusive. */
+    double min;
+    double max;
+
+    /* if nonzero, the value must be a multiple of this. */
+    size_t multiple;
+
+    /* false if the value is fixed once arenas_init() has run. */
+    bool runtime;
+} conf_entry_t;
+
+static const conf_entry_t conf_entries[] = {
+    { "cache_max_entries", CONF_SIZE, offsetof(pm_config_t, cache_max_entries),
+      0, CACHE_CAPACITY, 0, true },
+    { "cache_max_size", CONF_SIZE, offsetof(pm_config_t, cache_max_size),
+      0, (double)(1UL << 40), 0, true },
+    { "cache_evict_probability", CONF_FLOAT,
+      offsetof(pm_config_t, cache_evict_probability), 0, 1, 0, true },
+    { "maxlists", CONF_SIZE, offsetof(pm_config_t, maxlists),
+      1, SEGLIST_CAPACITY, 0, false },
+    { "max_seglist_search", CONF_SIZE, offsetof(pm_config_t, max_seglist_search),
+      1, (double)(1UL << 20), 0, true },
+    /* the heap is 16-byte aligned, and every extension is a block. */
+    { "chunk_size", CONF_SIZE, offsetof(pm_config_t, chunk_size),
+      32, (double)(1UL << 30), 16, true },
+    /* heap maps store 32-bit offsets, so arenas stay below 4 GB. */
+    { "arena_max_size", CONF_SIZE, offsetof(pm_config_t, arena_max_size),
+      CHUNK_SIZE << 3, (double)((1UL << 32) - CHUNK_SIZE), CHUNK_SIZE, false },
+    { "num_arenas", CONF_INT, offsetof(pm_config_t, num_arenas),
+      1, 4096, 0, false },
+    /* ignored unless the shared arenas keep at least one. */
+    { "lifetime_arenas", CONF_INT, offsetof(pm_config_t, lifetime_arenas),
+      0, 2048, 0, false },
+    { "lifetime_sample_interval", CONF_SIZE,
+      offsetof(pm_config_t, lifetime_sample_interval),
+      0, (double)(1UL << 30), 0, true },
+    { "provision_headroom", CONF_SIZE,
+      offsetof(pm_config_t, provision_headroom),
+      0, (double)(1UL << 32), 0, false },
+    /* anything past arena_max_size is ignored. */
+    { "arena_prefault", CONF_SIZE, offsetof(pm_config_t, arena_prefault),
+      0, (double)(1UL << 32), 0, false },
+    { "pressure_interval_ms", CONF_SIZE,
+      offsetof(pm_config_t, pressure_interval_ms), 0, 60000, 0, false },
+    { "pressure_psi_threshold", CONF_FLOAT,
+      offsetof(pm_config_t, pressure_psi_threshold), 0, 100, 0, true },
+    { "pressure_limit_ratio", CONF_FLOAT,
+      offsetof(pm_config_t, pressure_limit_ratio), 0, 1, 0, true },
+};
+
+#define NUM_CONF_ENTRIES  (sizeof(conf_entries) / sizeof(conf_entries[0]))
+
+static pthread_once_t conf_once = PTHREAD_ONCE_INIT;
+static bool conf_frozen = false;
+
+static const conf_entry_t *conf_lookup(const char *name, size_t len) {
+    for (size_t i = 0; i < NUM_CONF_ENTRIES; i++) {
+        if (strlen(conf_entries[i].name) == len &&
+            strncmp(conf_entries[i].name, name, len) == 0)
+            return &conf_entries[i];
+    }
+    return NULL;
+}
+
+static size_t conf_size(const conf_entry_t *e) {
+    switch (e->type) {
+    case CONF_SIZE:  return sizeof(size_t);
+    case CONF_INT:   return sizeof(int);
+    case CONF_FLOAT: return sizeof(float);
+    }
+    return 0;
+}
+
+/* validates and stores a new value. the allocator reads tunables
+ * without locks, so the store itself is atomic.
+ */
+static int conf_set(const conf_entry_t *e, double value) {
+    if (conf_frozen && !e->runtime)
+        return EPERM;
+    if (value < e->min || value > e->max)
+        return EINVAL;
+
+    char *field = (char *)&pm_config + e->offset;
+    switch (e->type) {
+    case CONF_SIZE:
+        if (e->multiple && (size_t)value % e->multiple != 0)
+            return EINVAL;
+        __atomic_store_n((size_t *)field, (size_t)value, __ATOMIC_RELAXED);
+        break;
+    case CONF_INT:
+        __atomic_store_n((int *)field, (int)value, __ATOMIC_RELAXED);
+        break;
+    case CONF_FLOAT: {
+        float f = (float)value;
+        __atomic_store((float *)field, &f, __ATOMIC_RELAXED);
+        break;
+    }
+    }
+    return 0;
+}
+
+/* parses a number with an optional k/m/g suffix. */
+static bool parse_value(const char *str, double *value) {
+    char *end;
+    *value = strtod(str, &end);
+    if (end == str)
+        return false;
+
+    switch (*end) {
+    case 'k': case 'K': *value *= 1 << 10; end++; break;
+    case 'm': case 'M': *value *= 1 << 20; end++; break;
+    case 'g': case 'G': *value *= 1 << 30; end++; break;
+    }
+    return *end == '\0';
+}
+
+static void parse_env(void) {
+    const char *conf = getenv(PM_CONF_ENV);
+    if (!conf)
+        return;
+
+    while (*conf) {
+        size_t len = strcspn(conf, ",");
+        const char *colon = memchr(conf, ':', len);
+
+        char value[64];
+        const conf_entry_t *e = NULL;
+        bool ok = false;
+        if (colon && (size_t)(conf + len - colon) <= sizeof(value)) {
+            e = conf_lookup(conf, colon - conf);
+            memcpy(value, colon + 1, conf + len - colon - 1);
+            value[conf + len - colon - 1] = '\0';
+
+            double v;
+            ok = e && parse_value(value, &v) && conf_set(e, v) == 0;
+        }
+        if (!ok) {
+            fprintf(stderr, "pmalloc: ignoring %s option '%.*s'\n",
+                    e ? "invalid" : "unknown", (int)len, conf);
+        }
+
+        conf += len;
+        if (*conf == ',')
+            conf++;
+    }
+}
+
+void pm_config_init(void) {
+    pthread_once(&conf_once, parse_env);
+}
+
+void pm_config_freeze(void) {
+    conf_frozen = true;
+}
+
+int pm_ctl(const char *name, void *oldp, size_t *oldlenp,
+           const void *newp, size_t newlen) {
+    const conf_entry_t *e = conf_lookup(name, strlen(name));
+    if (!e)
+        return ENOENT;
+
+    size_t size = conf_size(e);
+    if (oldp) {
+        if (!oldlenp || *oldlenp != size)
+            return EINVAL;
+        memcpy(oldp, (char *)&pm_config + e->offset, size);
+    }
+
+    if (newp) {
+        if (newlen != size)
+            return EINVAL;
+
+        double value;
+        switch (e->type) {
+        case CONF_SIZE:  value = (double)*(const size_t *)newp; break;
+        case CONF_INT:   value = (double)*(const int *)newp; break;
+        case CONF_FLOAT: value = (double)*(const float *)newp; break;
+        default:         return EINVAL;
+        }
+        return conf_set(e, value);
+    }
+    return 0;
+}
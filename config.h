@@ -0,0 +1,79 @@
+/* runtime tunables.
+ *
+ * every tunable starts out at the compile-time default from malloc.h
+ * or thread_cache.h. at init, these can be overridden through the
+ * PMALLOC_CONF environment variable, a comma separated list of
+ * name:value pairs, e.g.
+ *
+ *     PMALLOC_CONF="num_arenas:16,cache_max_entries:4,chunk_size:8192"
+ *
+ * afterwards, pm_ctl() reads and writes them by name. tunables that
+ * shape the arenas themselves (maxlists, arena_max_size, num_arenas,
+ * lifetime_arenas, arena_prefault), or that start threads with them
+ * (provision_headroom, pressure_interval_ms), can only be changed
+ * before arenas_init() runs.
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define PM_CONF_ENV  "PMALLOC_CONF"
+
+typedef struct pm_config {
+    /* thread cache limits (see thread_cache.h). */
+    size_t cache_max_entries;
+    size_t cache_max_size;
+    float cache_evict_probability;
+
+    /* seglist shape and search depth (see malloc.h). */
+    size_t maxlists;
+    size_t max_seglist_search;
+
+    /* minimum amount the heap is extended by. */
+    size_t chunk_size;
+
+    /* arena layout. */
+    size_t arena_max_size;
+    int num_arenas;
+
+    /* arenas set aside for each long-lived lifetime pool. */
+    int lifetime_arenas;
+
+    /* lifetime prediction by call site (see sites.h). */
+    size_t lifetime_sample_interval;
+
+    /* memory kept faulted in past each arena's heap (see provision.h). */
+    size_t provision_headroom;
+
+    /* memory faulted in at the start of each arena when it is mapped. */
+    size_t arena_prefault;
+
+    /* memory pressure monitoring (see pressure.h). */
+    size_t pressure_interval_ms;
+    float pressure_psi_threshold;
+    float pressure_limit_ratio;
+} pm_config_t;
+
+extern pm_config_t pm_config;
+
+/* reads PM_CONF_ENV. safe to call more than once. */
+void pm_config_init(void);
+
+/* called by arenas_init(). after this, tunables that shape the
+ * arenas become read-only.
+ */
+void pm_config_freeze(void);
+
+/* mallctl-style access to a tunable. if oldp is given, the current
+ * value is copied there (*oldlenp must be the size of the value).
+ * if newp is given, the value is replaced with newp.
+ * returns 0 on success, or ENOENT (no such tunable), EINVAL (wrong
+ * size or out of range) or EPERM (can no longer be changed).
+ */
+int pm_ctl(const char *name, void *oldp, size_t *oldlenp,
+           const void *newp, size_t newlen);
+
+#endif
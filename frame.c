@@ -0,0 +1,134 @@
+/**
+ * @file frame.c
+ * @brief per-thread bins for fixed-size frames
+ *
+ * A frame is an ordinary allocated block from the cached allocator.
+ * Free frames sit on intrusive per-thread stacks, one per 16-byte size
+ * step, and stay marked allocated in their arena the whole time, so
+ * the arena never sees them come and go. An empty bin is refilled with
+ * a batch of blocks from one arena (the count comes from class_batch
+ * in size_classes.h); a full bin sends frames back through
+ * arena_cached_free(). A thread's bins are emptied into their arenas
+ * when it exits.
+ */
+
+#include "frame.h"
+#include "malloc.h"
+
+#include <pthread.h>
+
+#define FRAME_NUM_BINS  (FRAME_MAX_SIZE / 16)
+
+typedef struct frame_bin {
+    void *top;
+    size_t count;
+} frame_bin_t;
+
+static __thread frame_bin_t bins[FRAME_NUM_BINS];
+
+/* set for threads that have frames in their bins, so that
+ * frame_thread_exit() runs when they go away.
+ */
+static pthread_key_t frame_exit_key;
+static pthread_once_t frame_exit_key_once = PTHREAD_ONCE_INIT;
+static __thread bool frame_exit_key_set;
+
+/* the frames go straight back to their arenas: arena_cached_free()
+ * would put them in the thread cache, which nothing empties once the
+ * thread is gone.
+ */
+static void frame_thread_exit(void *arg) {
+    (void)arg;
+    void *frames[FRAME_BIN_MAX];
+
+    for (int i = 0; i < FRAME_NUM_BINS; i++) {
+        size_t n = 0;
+        while (bins[i].top) {
+            void *frame = bins[i].top;
+            bins[i].top = *(void **)frame;
+            arena_cached_release(frame);
+            frames[n++] = frame;
+            if (n == FRAME_BIN_MAX) {
+                arena_cached_free_batch(frames, n);
+                n = 0;
+            }
+        }
+        arena_cached_free_batch(frames, n);
+        bins[i].count = 0;
+    }
+}
+
+static void make_frame_exit_key(void) {
+    pthread_key_create(&frame_exit_key, frame_thread_exit);
+}
+
+static void watch_thread_exit(void) {
+    if (frame_exit_key_set)
+        return;
+    pthread_once(&frame_exit_key_once, make_frame_exit_key);
+    pthread_setspecific(frame_exit_key, bins);
+    frame_exit_key_set = true;
+}
+
+/* bin i holds frames of up to 16 * (i + 1) bytes. */
+static size_t bin_index(size_t size) {
+    return size == 0 ? 0 : (size - 1) / 16;
+}
+
+/* fills an empty bin with a batch of frames, and returns one more. */
+static void *refill(frame_bin_t *bin, size_t size) {
+    void *frames[64];
+    size_t batch = class_batch[size_to_class(pm_nallocx(size, 0) + wsize)];
+    if (batch > sizeof(frames) / sizeof(frames[0]))
+        batch = sizeof(frames) / sizeof(frames[0]);
+
+    size_t got = arena_cached_malloc_batch(size, frames, batch);
+    if (got == 0)
+        return NULL;
+
+    if (got > 1)
+        watch_thread_exit();
+    for (size_t i = 1; i < got; i++) {
+        *(void **)frames[i] = bin->top;
+        bin->top = frames[i];
+        bin->count++;
+    }
+    return frames[0];
+}
+
+void *pm_frame_alloc(size_t size) {
+    if (size > FRAME_MAX_SIZE)
+        return arena_cached_malloc(size);
+
+    size_t index = bin_index(size);
+    frame_bin_t *bin = &bins[index];
+
+    void *frame = bin->top;
+    if (frame) {
+        bin->top = *(void **)frame;
+        bin->count--;
+        return frame;
+    }
+    /* every frame in a bin is big enough for the bin's largest size. */
+    return refill(bin, 16 * (index + 1));
+}
+
+void pm_frame_free(void *frame, size_t size) {
+    if (frame == NULL)
+        return;
+    if (size > FRAME_MAX_SIZE) {
+        arena_cached_free(frame);
+        return;
+    }
+
+    frame_bin_t *bin = &bins[bin_index(size)];
+    if (bin->count >= FRAME_BIN_MAX) {
+        arena_cached_free(frame);
+        return;
+    }
+
+    watch_thread_exit();
+    *(void **)frame = bin->top;
+    bin->top = frame;
+    bin->count++;
+}
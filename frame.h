@@ -0,0 +1,39 @@
+/* allocation for short-lived objects of a size known at both ends,
+ * such as C++20 coroutine frames (see frame.hpp).
+ *
+ * the caller passes the size to pm_frame_free() as well, so a frame
+ * goes straight back to a per-thread bin for its size, without reading
+ * any block header. bins are refilled from the cached allocator
+ * several frames at a time, so the same setup applies: call
+ * arena_cached_malloc_init() once, and init_tcache() in each thread.
+ */
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* frames up to this size are binned, in 16-byte steps. larger ones
+ * go to arena_cached_malloc() and arena_cached_free() directly.
+ */
+#define FRAME_MAX_SIZE  1024
+
+/* most free frames a thread keeps in one bin. */
+#define FRAME_BIN_MAX  64
+
+void *pm_frame_alloc(size_t size);
+
+/* size must be the size the frame was allocated with. a frame may be
+ * freed by any thread.
+ */
+void pm_frame_free(void *frame, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
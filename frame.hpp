@@ -0,0 +1,87 @@
+/* C++ glue for frame.h.
+ *
+ * a coroutine's frame is allocated through its promise type, so
+ * deriving the promise from pm_frame_promise puts every frame of that
+ * coroutine in the frame bins:
+ *
+ *     struct task {
+ *         struct promise_type : pm_frame_promise { ... };
+ *     };
+ *
+ * the compiler passes the frame size to both operators, which is what
+ * lets a frame be freed without looking at its header.
+ *
+ * pm_frame_allocator<T> is a standard allocator over the same bins,
+ * for containers of small nodes and for coroutines whose promise takes
+ * an allocator through std::allocator_arg.
+ */
+
+#ifndef FRAME_HPP_
+#define FRAME_HPP_
+
+#include "frame.h"
+
+#include <cstddef>
+#include <new>
+
+struct pm_frame_promise {
+    static void *operator new(std::size_t size) {
+        void *frame = pm_frame_alloc(size);
+        if (frame == nullptr)
+            throw std::bad_alloc();
+        return frame;
+    }
+
+    static void operator delete(void *frame, std::size_t size) noexcept {
+        pm_frame_free(frame, size);
+    }
+};
+
+/* a promise for coroutines that must not throw. their return type
+ * provides get_return_object_on_allocation_failure(), and a coroutine
+ * whose frame can't be allocated returns that instead.
+ */
+struct pm_frame_promise_nothrow {
+    static void *operator new(std::size_t size) noexcept {
+        return pm_frame_alloc(size);
+    }
+
+    static void operator delete(void *frame, std::size_t size) noexcept {
+        pm_frame_free(frame, size);
+    }
+};
+
+template <typename T>
+struct pm_frame_allocator {
+    typedef T value_type;
+
+    pm_frame_allocator() noexcept {}
+
+    template <typename U>
+    pm_frame_allocator(const pm_frame_allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T))
+            throw std::bad_alloc();
+        void *frame = pm_frame_alloc(n * sizeof(T));
+        if (frame == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(frame);
+    }
+
+    void deallocate(T *frame, std::size_t n) noexcept {
+        pm_frame_free(frame, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const pm_frame_allocator<T> &, const pm_frame_allocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const pm_frame_allocator<T> &, const pm_frame_allocator<U> &) noexcept {
+    return false;
+}
+
+#endif
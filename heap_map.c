@@ -0,0 +1,108 @@
+/**
+ * @file heap_map.c
+ * @brief dumps the block layout of every arena to a file
+ *
+ * Each arena is walked along its implicit list, from heap_start
+ * up to the epilogue, and every block is recorded as an
+ * (offset, size, allocation bit) triple. The walk is copied into
+ * a scratch buffer while the arena lock is held, and only
+ * written out after the lock is released, so that dumping a
+ * large heap doesn't stall the threads using that arena.
+ */
+
+#include "heap_map.h"
+#include "malloc.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * Finds the next consecutive block on the heap.
+ * requires that the block is not the epilogue
+ */
+static block_t *map_next(block_t *block) {
+    return (block_t *)((char *)block + get_size(block));
+}
+
+/* write() that retries on short writes. */
+static bool write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// precondition: lock on arena is already held
+static uint32_t count_blocks(arena_t *arena) {
+    uint32_t count = 0;
+    for (block_t *block = arena->heap_start; block && get_size(block) != 0;
+         block = map_next(block)) {
+        count++;
+    }
+    return count;
+}
+
+static bool dump_arena_map(int fd, int index) {
+    arena_t *arena = get_arena_at(index);
+    heap_map_arena_t hdr = {
+        .heap_start = (uintptr_t)arena->heap_start,
+        .heap_end = (uintptr_t)arena->heap_end,
+        .index = index,
+        .num_blocks = count_blocks(arena)
+    };
+
+    size_t bytes = hdr.num_blocks * sizeof(heap_map_block_t);
+    heap_map_block_t *blocks = NULL;
+    if (bytes > 0) {
+        blocks = map_region(bytes, "pmalloc:heap_map");
+        if (!blocks) {
+            release_arena(arena);
+            return false;
+        }
+    }
+
+    uint32_t i = 0;
+    for (block_t *block = arena->heap_start; block && get_size(block) != 0;
+         block = map_next(block)) {
+        blocks[i].offset = (char *)block - (char *)arena->heap_start;
+        blocks[i].size_alloc = get_size(block) | (block->header & alloc_mask);
+        i++;
+    }
+    release_arena(arena);
+
+    bool ok = write_all(fd, &hdr, sizeof(hdr)) &&
+              write_all(fd, blocks, bytes);
+    if (blocks)
+        munmap(blocks, bytes);
+    return ok;
+}
+
+/* writes a map of every arena to the file at path, overwriting
+ * it if it exists. returns false if the file couldn't be written.
+ */
+bool heap_map_dump(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    heap_map_header_t hdr;
+    memcpy(hdr.magic, HEAP_MAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = HEAP_MAP_VERSION;
+    hdr.num_arenas = arena_count();
+    hdr.reserved = 0;
+
+    bool ok = write_all(fd, &hdr, sizeof(hdr));
+    for (int i = 0; ok && i < arena_count(); i++) {
+        ok = dump_arena_map(fd, i);
+    }
+
+    close(fd);
+    return ok;
+}
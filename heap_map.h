@@ -0,0 +1,47 @@
+/* binary heap maps, for offline fragmentation analysis.
+ * see tools/heapmap.py for the reader.
+ */
+
+#ifndef HEAP_MAP_H_
+#define HEAP_MAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HEAP_MAP_MAGIC    "PMHM"
+#define HEAP_MAP_VERSION  1
+
+/* layout of a heap map file (all fields are native endian):
+ *
+ *   heap_map_header_t
+ *   for each arena:
+ *       heap_map_arena_t
+ *       heap_map_block_t * num_blocks
+ */
+typedef struct heap_map_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_arenas;
+    uint32_t reserved;
+} heap_map_header_t;
+
+typedef struct heap_map_arena {
+    uint64_t heap_start;
+    uint64_t heap_end;
+    uint32_t index;
+    uint32_t num_blocks;
+} heap_map_arena_t;
+
+/* arenas are kept below 4 GB (see the arena_max_size tunable), so
+ * both the offset from heap_start and the block size fit in 32 bits.
+ * the lowest bit of size_alloc is the allocation bit, just
+ * like in a block header.
+ */
+typedef struct heap_map_block {
+    uint32_t offset;
+    uint32_t size_alloc;
+} heap_map_block_t;
+
+bool heap_map_dump(const char *path);
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * @file iobuf.c
+ * @brief a pool of page-aligned I/O buffers
+ *
+ * Every buffer is its own anonymous mapping, so it is page aligned,
+ * a whole number of pages, and never touches the arenas. Free buffers
+ * are kept on intrusive stacks: the first word of a free buffer points
+ * to the next one. Each thread has a small stack per pool and size
+ * class, and each pool has a locked depot per size class that threads
+ * spill into and refill from. A thread's stacks are moved to the
+ * depots when it exits.
+ */
+
+#include "iobuf.h"
+#include "malloc.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef struct iobuf_stack {
+    void *top;
+    size_t count;
+} iobuf_stack_t;
+
+typedef struct iobuf_depot {
+    pthread_mutex_t lock;
+    iobuf_stack_t stack;
+} iobuf_depot_t;
+
+struct iobuf_pool {
+    int flags;
+    iobuf_depot_t depots[IOBUF_NUM_CLASSES];
+};
+
+static iobuf_pool_t pools[IOBUF_MAX_POOLS];
+static int num_pools = 0;
+static size_t iobuf_page_size;
+
+static __thread iobuf_stack_t thread_stacks[IOBUF_MAX_POOLS][IOBUF_NUM_CLASSES];
+
+/* set for threads that have buffers on their stacks, so that
+ * iobuf_thread_exit() runs when they go away.
+ */
+static pthread_key_t iobuf_exit_key;
+static pthread_once_t iobuf_exit_key_once = PTHREAD_ONCE_INIT;
+static __thread bool iobuf_exit_key_set;
+
+static void push(iobuf_stack_t *stack, void *buf) {
+    *(void **)buf = stack->top;
+    stack->top = buf;
+    stack->count++;
+}
+
+static void *pop(iobuf_stack_t *stack) {
+    void *buf = stack->top;
+    if (buf) {
+        stack->top = *(void **)buf;
+        stack->count--;
+    }
+    return buf;
+}
+
+static size_t class_size(int class) {
+    return iobuf_page_size << class;
+}
+
+/* returns the smallest class that holds size bytes, or
+ * IOBUF_NUM_CLASSES if it is too big for any of them.
+ */
+static int size_to_iobuf_class(size_t size) {
+    int class = 0;
+    while (class < IOBUF_NUM_CLASSES && class_size(class) < size)
+        class++;
+    return class;
+}
+
+static void *map_buffer(iobuf_pool_t *pool, size_t size) {
+    int mmap_flags = MAP_ANONYMOUS | MAP_PRIVATE;
+    if (pool->flags & IOBUF_PREFAULT)
+        mmap_flags |= MAP_POPULATE;
+
+    void *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
+    if (buf == MAP_FAILED)
+        return NULL;
+
+    if ((pool->flags & IOBUF_MLOCK) && mlock(buf, size) != 0) {
+        munmap(buf, size);
+        return NULL;
+    }
+    name_mapping(buf, size, "pmalloc:iobuf");
+    return buf;
+}
+
+/* moves buf to the pool's depot, or unmaps it if the depot is full. */
+static void depot_put(iobuf_pool_t *pool, int class, void *buf) {
+    iobuf_depot_t *depot = &pool->depots[class];
+
+    pthread_mutex_lock(&depot->lock);
+    if (depot->stack.count < IOBUF_DEPOT_MAX) {
+        push(&depot->stack, buf);
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&depot->lock);
+
+    if (buf)
+        munmap(buf, class_size(class));
+}
+
+static void iobuf_thread_exit(void *arg) {
+    (void)arg;
+    for (int p = 0; p < IOBUF_MAX_POOLS; p++) {
+        for (int c = 0; c < IOBUF_NUM_CLASSES; c++) {
+            void *buf;
+            while ((buf = pop(&thread_stacks[p][c])))
+                depot_put(&pools[p], c, buf);
+        }
+    }
+}
+
+static void make_iobuf_exit_key(void) {
+    pthread_key_create(&iobuf_exit_key, iobuf_thread_exit);
+    iobuf_page_size = sysconf(_SC_PAGESIZE);
+}
+
+iobuf_pool_t *pm_iobuf_pool_create(int flags) {
+    pthread_once(&iobuf_exit_key_once, make_iobuf_exit_key);
+
+    int index = __atomic_fetch_add(&num_pools, 1, __ATOMIC_SEQ_CST);
+    if (index >= IOBUF_MAX_POOLS)
+        return NULL;
+
+    iobuf_pool_t *pool = &pools[index];
+    pool->flags = flags;
+    for (int c = 0; c < IOBUF_NUM_CLASSES; c++) {
+        pthread_mutex_init(&pool->depots[c].lock, NULL);
+    }
+    return pool;
+}
+
+void *pm_iobuf_alloc(iobuf_pool_t *pool, size_t size) {
+    int class = size_to_iobuf_class(size);
+    if (class == IOBUF_NUM_CLASSES) {
+        size = (size + iobuf_page_size - 1) & ~(iobuf_page_size - 1);
+        return map_buffer(pool, size);
+    }
+
+    void *buf = pop(&thread_stacks[pool - pools][class]);
+    if (buf)
+        return buf;
+
+    iobuf_depot_t *depot = &pool->depots[class];
+    pthread_mutex_lock(&depot->lock);
+    buf = pop(&depot->stack);
+    pthread_mutex_unlock(&depot->lock);
+    if (buf)
+        return buf;
+
+    return map_buffer(pool, class_size(class));
+}
+
+void pm_iobuf_free(iobuf_pool_t *pool, void *buf, size_t size) {
+    if (buf == NULL)
+        return;
+
+    int class = size_to_iobuf_class(size);
+    if (class == IOBUF_NUM_CLASSES) {
+        size = (size + iobuf_page_size - 1) & ~(iobuf_page_size - 1);
+        munmap(buf, size);
+        return;
+    }
+
+    iobuf_stack_t *stack = &thread_stacks[pool - pools][class];
+    if (stack->count >= IOBUF_THREAD_MAX) {
+        depot_put(pool, class, buf);
+        return;
+    }
+
+    if (!iobuf_exit_key_set) {
+        pthread_setspecific(iobuf_exit_key, pool);
+        iobuf_exit_key_set = true;
+    }
+    push(stack, buf);
+}
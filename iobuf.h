@@ -0,0 +1,57 @@
+/* page-aligned buffers for O_DIRECT and zero-copy I/O.
+ *
+ * buffers come in power-of-two multiples of the page size, and are
+ * mapped directly rather than carved out of an arena, so they are
+ * always page aligned and never share a page with anything else.
+ * freed buffers are kept for reuse on a per-thread stack for their
+ * size, so recycling one takes no lock and no system call. when a
+ * thread's stack is full, buffers go to a shared depot for other
+ * threads, and past that they are unmapped.
+ */
+
+#ifndef IOBUF_H_
+#define IOBUF_H_
+
+#include <stddef.h>
+
+/* pool flags. */
+enum {
+    /* keep the pool's buffers resident with mlock(). */
+    IOBUF_MLOCK = 0x1,
+    /* fault every page in when a buffer is first mapped. */
+    IOBUF_PREFAULT = 0x2
+};
+
+/* number of power-of-two size classes, from one page up to 1024
+ * pages (4 MB with 4 KB pages). buffers up to the largest class are
+ * recycled; larger ones are mapped and unmapped every time.
+ */
+#define IOBUF_NUM_CLASSES  11
+
+/* free buffers of each size kept per thread, and in the depot. */
+#define IOBUF_THREAD_MAX  4
+#define IOBUF_DEPOT_MAX   32
+
+/* number of pools a process can create. */
+#define IOBUF_MAX_POOLS  8
+
+typedef struct iobuf_pool iobuf_pool_t;
+
+/* creates a pool whose buffers all have the given flags. pools last
+ * as long as the process. returns NULL once IOBUF_MAX_POOLS pools
+ * exist.
+ */
+iobuf_pool_t *pm_iobuf_pool_create(int flags);
+
+/* returns a buffer of at least size bytes, rounded up to a
+ * power-of-two number of pages, or NULL if it couldn't be mapped
+ * (or locked, for IOBUF_MLOCK pools).
+ */
+void *pm_iobuf_alloc(iobuf_pool_t *pool, size_t size);
+
+/* gives a buffer back. size is the size it was allocated with. any
+ * thread may free a buffer, not only the one that allocated it.
+ */
+void pm_iobuf_free(iobuf_pool_t *pool, void *buf, size_t size);
+
+#endif
@@ -1,15 +1,22 @@
 #ifndef MALLOC_H_
 #define MALLOC_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <pthread.h>
 #include <stdbool.h>
 
+#include "size_classes.h"
+
 typedef uint64_t word_t;
 
 enum {
     alloc_mask = 0x1,
-    prev_alloc_mask = 0x2
+    prev_alloc_mask = 0x2,
+    /* allocated blocks only: the block is a lifetime sample
+     * (see sites.h).
+     */
+    sampled_mask = 0x4
 };
 
 #define CHUNK_SIZE  (1 << 12)
@@ -30,8 +37,57 @@ enum {
  */
 #define ARENA_RESERVE   (CHUNK_SIZE << 3)
 
-/* max number of lists per arena. */
-#define MAXLISTS  15
+/* one seglist per size class (see size_classes.spec). the "maxlists"
+ * tunable can lower the number in use, which folds the largest classes
+ * into the last list.
+ */
+#define MAXLISTS  NUM_SIZE_CLASSES
+#define SEGLIST_CAPACITY  NUM_SIZE_CLASSES
+
+/* how many entries of a seglist are looked at before settling
+ * for the best fit found so far.
+ */
+#define MAX_SEGLIST_SEARCH  15
+
+/* default number of arenas. */
+#define NUM_ARENAS  10
+
+/* arenas set aside for each of the long-lived lifetime pools. 0
+ * leaves every pool shared, so that the default build spreads threads
+ * over all NUM_ARENAS arenas.
+ */
+#define LIFETIME_ARENAS  0
+
+/* sample one allocation in this many for lifetime prediction
+ * (see sites.h). 0 turns prediction off.
+ */
+#define LIFETIME_SAMPLE_INTERVAL  0
+
+/* bytes past each arena's heap that a background thread keeps faulted
+ * in (see provision.h). 0 starts no thread.
+ */
+#define PROVISION_HEADROOM  0
+
+/* bytes at the start of each arena faulted in when it is mapped, so
+ * that the first allocations don't take page faults under the arena
+ * lock. 0 faults nothing in up front.
+ */
+#define ARENA_PREFAULT  0
+
+/* blocks pm_thread_reserve() takes from an arena per lock hold. */
+#define RESERVE_BATCH  64
+
+/* how often memory pressure is checked (see pressure.h). 0 starts no
+ * monitor.
+ */
+#define PRESSURE_INTERVAL_MS  0
+
+/* the memory pressure thresholds: the percentage of time stalled on
+ * memory ("some avg10"), and the share of the cgroup's memory limit in
+ * use. 0 turns either one off.
+ */
+#define PRESSURE_PSI_THRESHOLD  10.0f
+#define PRESSURE_LIMIT_RATIO  0.9f
 
 /* pthread key associated with thread-local cache. */
 
@@ -54,12 +110,16 @@ typedef struct arena {
     void *heap_end; 
 
     /* lists for heap lookup within this arena. */
-    block_t *seglists[MAXLISTS];
+    block_t *seglists[SEGLIST_CAPACITY];
 
     /* lock on arena usage. any allocations or frees taking place
      * on this arena must acquire this lock before proceeding.
      */
     pthread_mutex_t lock;
+
+    /* state of the sampled heap checker (see checkheap.c). */
+    unsigned check_ticks;
+    unsigned check_list;
 } arena_t;
 
 /** @brief Represents the header and payload of one block in the heap */
@@ -76,17 +136,67 @@ typedef struct block {
     };
 } block_t;
 
-/* initializes the thread-local cache. the thread-local
- * storage location is provided by the gcc __thread keyword.
+/*
+ * block layout helpers. these are shared by the allocators and by
+ * everything that walks their heaps, and are inline so that the
+ * allocation paths don't make a call for every header they read.
  */
-void init_tcache(void);
 
-size_t get_size(block_t *block);
-size_t extract_size(word_t word);
+/** Word and header size (bytes) */
+static const size_t wsize = sizeof(word_t);
+
+/** Double word size (bytes) */
+static const size_t dsize = 2 * sizeof(word_t);
+
+/** Minimum block size (bytes) */
+static const size_t min_block_size = 4 * sizeof(word_t);
+
+/* size is stored in the upper bits, up to bit 55. the top byte of an
+ * allocated block's header holds its tag (see tags.h).
+ */
+static const word_t size_mask = 0x00fffffffffffff0;
+static const int tag_shift = 56;
+static const word_t tag_mask = ~(word_t)0 << 56;
+
+/**
+ * @brief Packs the `size` and `alloc` of a block into a word suitable for
+ *        use as a packed value.
+ *
+ * Packed values are used for both headers and footers.
+ *
+ * The allocation status is packed into the lowest bit of the word.
+ *
+ * @param[in] size The size of the block being represented
+ * @param[in] alloc True if the block is allocated
+ * @return The packed value
+ */
+static inline word_t pack(size_t size, bool alloc, bool prev_alloc) {
+    word_t word = size;
+    if (alloc) {
+        word |= alloc_mask;
+    }
+    if (prev_alloc) {
+        word |= prev_alloc_mask;
+    }
+    return word;
+}
+
+static inline size_t extract_size(word_t word) {
+    return (word & size_mask);
+}
 
-word_t pack(size_t size, bool alloc, bool prev_alloc);
+static inline size_t get_size(block_t *block) {
+    return extract_size(block->header);
+}
 
-block_t *extend_arena_heap(arena_t *arena, size_t size, bool prev_alloc);
+static inline unsigned get_tag(block_t *block) {
+    return (unsigned)(block->header >> tag_shift);
+}
+
+/* initializes the thread-local cache. the thread-local
+ * storage location is provided by the gcc __thread keyword.
+ */
+void init_tcache(void);
 
 // possibly could just allow for malloc() to call this.
 // in a multithreaded environment, it's simpler to just
@@ -98,10 +208,63 @@ bool arena_malloc_init(void);
 bool arena_cached_malloc_init(void);
 bool naive_malloc_init(void);
 
+/* how long an allocation is expected to live. long-lived and
+ * permanent blocks each get a pool of arenas of their own when the
+ * "lifetime_arenas" tunable sets its size, so that they don't pin
+ * down pages that would otherwise free up once the short-lived blocks
+ * around them go away. short-lived and unhinted blocks share the rest
+ * of the arenas.
+ */
+typedef enum pm_lifetime {
+    PM_LIFETIME_DEFAULT,
+    PM_LIFETIME_SHORT,
+    PM_LIFETIME_LONG,
+    PM_LIFETIME_PERMANENT
+} pm_lifetime_t;
+
+#define PM_NUM_LIFETIMES  4
+
 // returns an available arena (one not currently used)
 // by any other processors.
 arena_t *get_arena(void);
+arena_t *get_lifetime_arena(pm_lifetime_t lifetime);
+arena_t *get_arena_at(int index);
 arena_t *find_arena(void *address);
+int arena_index(void *address);
+
+/* resident, dirty and swapped bytes of one arena's mapping,
+ * as reported by /proc/self/smaps.
+ */
+typedef struct arena_rss {
+    size_t resident;
+    size_t dirty;
+    size_t swapped;
+} arena_rss_t;
+
+void name_mapping(void *addr, size_t length, const char *name);
+void *map_region(size_t length, const char *name);
+
+/* faults in the pages of [addr, addr + length) as a write would. on
+ * kernels without MADV_POPULATE_WRITE the pages are written to, so
+ * nothing else may be using them.
+ */
+void prefault_region(void *addr, size_t length);
+
+/* gives the whole pages inside a free block back to the system. its
+ * header, list links and footer stay. returns the bytes purged.
+ */
+size_t purge_free_block(block_t *block);
+
+/* purges every free block of an arena, and everything past its heap.
+ * returns the bytes purged from free blocks.
+ * precondition: the arena is locked.
+ */
+size_t arena_purge(arena_t *arena);
+void arena_format(arena_t *arena, void *mem, size_t size);
+bool arena_map(arena_t *arena);
+int arena_count(void);
+arena_t *arena_at(int index);
+bool arena_rss(int index, arena_rss_t *rss);
 
 void *arena_high(arena_t *arena);
 void release_arena(arena_t *arena);
@@ -112,8 +275,122 @@ void *naive_malloc(size_t);
 void *arena_malloc(size_t);
 void *arena_cached_malloc(size_t);
 
+size_t arena_cached_malloc_batch(size_t size, void **ptrs, size_t n);
+
+/* a free in two halves, for frees finished by another thread (see
+ * reclaim.h): arena_cached_release() on the freeing thread, then
+ * arena_cached_free_batch() on any thread.
+ */
+void arena_cached_release(void *mem);
+void arena_cached_free_batch(void **ptrs, size_t n);
+
+/* has every thread free the blocks in its cache back to the arenas,
+ * the next time it allocates or frees through the cached allocator.
+ */
+void arena_cached_flush_caches(void);
+
 void naive_free(void *mem);
 void arena_free(void *mem);
 void arena_cached_free(void *mem);
 
+/* flags for pm_mallocx() and pm_freex(), or'ed together. pm_mallocx()
+ * with flags 0 is arena_cached_malloc(), and pm_freex() with flags 0
+ * is arena_cached_free().
+ */
+
+/* align the payload to 1 << la bytes. alignments up to 16 are the
+ * default, and cost nothing extra.
+ */
+#define PM_MALLOCX_LG_ALIGN(la)  ((int)(la))
+#define PM_MALLOCX_ALIGN(a)      ((int)__builtin_ctzl(a))
+#define PM_MALLOCX_LG_ALIGN_MASK  0x3f
+
+/* zero the payload. */
+#define PM_MALLOCX_ZERO  0x40
+
+/* skip the thread cache: allocate from, or free straight back to, the
+ * arena. blocks that are allocated once and kept for a long time can
+ * then neither take nor push out the cache's hot blocks.
+ */
+#define PM_MALLOCX_TCACHE_NONE  0x80
+
+/* for pm_freex(): keep the freed memory resident. under memory
+ * pressure (see pressure.h), frees otherwise give the whole pages of
+ * the free block they leave back to the system, once it is merged
+ * with its free neighbours. so kept memory can still be purged with
+ * a neighbour freed later without this, or when pressure next sets in.
+ */
+#define PM_MALLOCX_NO_PURGE  0x100
+
+/* allocate from the arenas for the given pm_lifetime_t. long-lived
+ * and permanent allocations skip the thread cache, whose blocks come
+ * from the shared arenas. free them with PM_MALLOCX_TCACHE_NONE, too,
+ * so that they go back to their own pool.
+ */
+#define PM_MALLOCX_LIFETIME_SHIFT  9
+#define PM_MALLOCX_LIFETIME(l)     ((int)(l) << PM_MALLOCX_LIFETIME_SHIFT)
+
+/* allocate from the arena at index i of the arena table, rather than
+ * from the next arena in turn (implies PM_MALLOCX_TCACHE_NONE for the
+ * allocation). the block can be freed like any other.
+ */
+#define PM_MALLOCX_ARENA_SHIFT  12
+#define PM_MALLOCX_ARENA(i)     (((int)(i) + 1) << PM_MALLOCX_ARENA_SHIFT)
+
+/* returns NULL if size is 0, if the arena index is out of range, or
+ * if there is no room. needs the same setup as arena_cached_malloc().
+ */
+void *pm_mallocx(size_t size, int flags);
+void pm_freex(void *mem, int flags);
+
+/* like pm_mallocx(), and also stores the payload's real size in
+ * *usable. that is at least pm_nallocx(size, flags), and more when the
+ * block came from the thread cache or had too little slack to split.
+ * the whole of it may be used.
+ */
+void *pm_smallocx(size_t size, int flags, size_t *usable);
+
+/* usable size of a pm_mallocx(size, flags) allocation, without
+ * allocating: what is left of the block it gets once the header is
+ * taken out. an aligned block is cut to the same size as an unaligned
+ * one, so only the size limit depends on PM_MALLOCX_LG_ALIGN. blocks
+ * come in 16-byte steps, so containers can grow to this size instead
+ * of size for free. returns 0 if size is 0 or too large for flags'
+ * alignment.
+ */
+size_t pm_nallocx(size_t size, int flags);
+
+/* gets the calling thread ready for a phase that must not take page
+ * faults or wait on arena locks. allocates about bytes worth of
+ * blocks of size_hint, spread over the shared arenas the way later
+ * allocations are, and faults in their pages. as many as fit go into
+ * the thread cache; the rest are freed back to their arenas, which
+ * then hold them as free memory that is already resident.
+ * returns the bytes reserved, which is less than bytes if the arenas
+ * ran out of room.
+ */
+size_t pm_thread_reserve(size_t bytes, size_t size_hint);
+
+/* allocation on one given arena, for arenas that live outside the
+ * arena table (see persist.h and shared.h). the caller holds the
+ * arena's lock.
+ */
+void *arena_malloc_in(arena_t *arena, size_t size);
+void arena_free_in(arena_t *arena, void *mem);
+
+/* picks up a heap laid out by arena_format() whose allocator state
+ * can't be trusted: one mapped from a file at a new address, or one
+ * whose lock holder died halfway through an operation. heap_end and
+ * the seglists are rebuilt from the implicit list, and the result is
+ * checked. low and size must be set.
+ * returns false if the heap is damaged.
+ */
+bool arena_recover(arena_t *arena);
+
+/* per-thread counters of bytes allocated and freed through
+ * arena_cached_malloc() and arena_cached_free().
+ */
+uint64_t *pm_thread_allocatedp(void);
+uint64_t *pm_thread_deallocatedp(void);
+
 #endif
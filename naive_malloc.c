@@ -50,7 +50,6 @@
 
 #endif
 
-#define MAXLISTS 15
 #define SEARCHCOUNT 2
 
 /* global lock to protect the entire heap. */
@@ -62,18 +61,6 @@ static bool mm_checkheap(int x) { return true; }
 
 typedef uint64_t word_t;
 
-/** Word and header size (bytes) */
-static const size_t wsize = sizeof(word_t);
-// 8B
-
-/** Double word size (bytes) */
-static const size_t dsize = 2 * wsize;
-// 16B
-
-/** Minimum block size (bytes) */
-static const size_t min_block_size = 2 * dsize;
-// 32B
-
 /**
  * (chunksize must be divisible by dsize)
  */
@@ -81,8 +68,6 @@ static const size_t chunksize = (1 << 12);
 // 2048B, divisible by 16
 // when heap is full, extend heap by this much
 
-static const word_t size_mask = ~(word_t)0xF;
-
 /* Global variables */
 
 /** Pointer to first block in the heap */
@@ -531,14 +516,7 @@ static void split_block(block_t *block, size_t asize) {
  */
 static size_t find_list_for_block(block_t *block) {
     dbg_requires(block);
-    // shift asize right to find list
-    // shift by 5 to min block size
-    size_t size = get_size(block) >> 6;
-    size_t list_ind = 0;
-    while (size != 0 && list_ind < MAXLISTS - 1) {
-        size >>= 1; // next power
-        list_ind++;
-    }
+    size_t list_ind = size_to_class(get_size(block));
     dbg_ensures(0 <= list_ind && list_ind <= MAXLISTS - 1);
     return list_ind;
 }
@@ -609,18 +587,8 @@ static block_t *search_list(block_t *list_start, size_t asize) {
  */
 static block_t *find_fit(size_t asize) {
     dbg_requires(asize > 0);
-    // asize a multiple of 16, min 32
     // get the smallest list it can have a fit
-    size_t size = asize >> 6; // 32 gives 0
-    size_t min_list_ind = 0;
-    while (size != 0) {
-        size >>= 1; // next power
-        min_list_ind++;
-    }
-
-    if (min_list_ind > MAXLISTS - 1) {
-        min_list_ind = MAXLISTS - 1;
-    }
+    size_t min_list_ind = size_to_class(asize);
 
     // search each possible list
     for (int list_ind = min_list_ind;
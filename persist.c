@@ -0,0 +1,203 @@
+/**
+ * @file persist.c
+ * @brief heaps backed by a file, for warm restarts
+ *
+ * The file holds a header page followed by a single arena, laid out
+ * exactly like an anonymous one (see arena_format()). Block headers and
+ * footers only hold sizes, so the implicit list is valid wherever the
+ * file is mapped. The seglists are the only absolute pointers the
+ * allocator keeps in a heap, and they are never trusted across runs:
+ * opening a heap walks its implicit list, checks it, and fills the
+ * seglists from scratch.
+ *
+ * The file is mapped at the address it had last time if that address
+ * is free, so that an application which does keep raw pointers in the
+ * heap usually gets away with it, but nothing here depends on that.
+ */
+
+#include "persist.h"
+#include "malloc.h"
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* older libc headers don't have this (added in Linux 4.17). kernels
+ * that don't know it treat the address as a hint, which is fine.
+ */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE  0x100000
+#endif
+
+struct pm_persist {
+    persist_header_t *hdr;
+    size_t size;
+    int fd;
+    bool was_clean;
+    arena_t arena;
+};
+
+/* checks the header of an existing heap file against its real size. */
+static bool read_header(int fd, off_t file_size, persist_header_t *hdr) {
+    if (pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr))
+        return false;
+    return memcmp(hdr->magic, PERSIST_MAGIC, sizeof(PERSIST_MAGIC)) == 0 &&
+           hdr->version == PERSIST_VERSION &&
+           hdr->size == (uint64_t)file_size &&
+           hdr->size > PERSIST_HEADER_SIZE &&
+           hdr->root < hdr->size;
+}
+
+pm_persist_t *pm_persist_open(const char *path, size_t size) {
+    pm_config_init();
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return NULL;
+
+    /* one process at a time; the lock goes away with the fd. */
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0)
+        goto fail_fd;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        goto fail_fd;
+
+    persist_header_t old;
+    bool fresh = st.st_size == 0;
+    if (fresh) {
+        /* the header page, and at least one chunk of heap. */
+        size_t page = PERSIST_HEADER_SIZE;
+        size = (size + page - 1) / page * page;
+        if (size < PERSIST_HEADER_SIZE + CHUNK_SIZE) {
+            errno = EINVAL;
+            goto fail_fd;
+        }
+        if (ftruncate(fd, size) < 0)
+            goto fail_fd;
+    } else {
+        if (!read_header(fd, st.st_size, &old)) {
+            errno = EINVAL;
+            goto fail_fd;
+        }
+        size = old.size;
+    }
+
+    void *mem = MAP_FAILED;
+    if (!fresh) {
+        mem = mmap((void *)(uintptr_t)old.base, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    }
+    if (mem == MAP_FAILED) {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED)
+            goto fail_fd;
+    }
+
+    pm_persist_t *heap = map_region(sizeof(*heap), "pmalloc:persist");
+    if (!heap)
+        goto fail_map;
+
+    heap->hdr = mem;
+    heap->size = size;
+    heap->fd = fd;
+    pthread_mutex_init(&heap->arena.lock, NULL);
+
+    void *low = (char *)mem + PERSIST_HEADER_SIZE;
+    size_t arena_size = size - PERSIST_HEADER_SIZE;
+    if (fresh) {
+        memset(heap->hdr, 0, sizeof(*heap->hdr));
+        memcpy(heap->hdr->magic, PERSIST_MAGIC, sizeof(PERSIST_MAGIC));
+        heap->hdr->version = PERSIST_VERSION;
+        heap->hdr->size = size;
+        heap->hdr->clean = true;
+        arena_format(&heap->arena, low, arena_size);
+    } else {
+        heap->arena.low = low;
+        heap->arena.size = arena_size;
+        if (!arena_recover(&heap->arena)) {
+            munmap(heap, sizeof(*heap));
+            errno = EINVAL;
+            goto fail_map;
+        }
+    }
+
+    heap->was_clean = heap->hdr->clean;
+    heap->hdr->base = (uintptr_t)mem;
+    heap->hdr->clean = false;
+    return heap;
+
+fail_map:
+    munmap(mem, size);
+fail_fd:
+    {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+bool pm_persist_sync(pm_persist_t *heap) {
+    pthread_mutex_lock(&heap->arena.lock);
+    bool ok = msync(heap->hdr, heap->size, MS_SYNC) == 0;
+    pthread_mutex_unlock(&heap->arena.lock);
+    return ok;
+}
+
+void pm_persist_close(pm_persist_t *heap) {
+    pthread_mutex_lock(&heap->arena.lock);
+    msync(heap->hdr, heap->size, MS_SYNC);
+    /* the flag goes out only after everything it vouches for. */
+    heap->hdr->clean = true;
+    msync(heap->hdr, PERSIST_HEADER_SIZE, MS_SYNC);
+    pthread_mutex_unlock(&heap->arena.lock);
+
+    munmap(heap->hdr, heap->size);
+    close(heap->fd);
+    pthread_mutex_destroy(&heap->arena.lock);
+    munmap(heap, sizeof(*heap));
+}
+
+bool pm_persist_was_clean(pm_persist_t *heap) {
+    return heap->was_clean;
+}
+
+void *pm_persist_malloc(pm_persist_t *heap, size_t size) {
+    pthread_mutex_lock(&heap->arena.lock);
+    void *ptr = arena_malloc_in(&heap->arena, size);
+    pthread_mutex_unlock(&heap->arena.lock);
+    return ptr;
+}
+
+void pm_persist_free(pm_persist_t *heap, void *ptr) {
+    pthread_mutex_lock(&heap->arena.lock);
+    arena_free_in(&heap->arena, ptr);
+    pthread_mutex_unlock(&heap->arena.lock);
+}
+
+void *pm_persist_root(pm_persist_t *heap) {
+    return pm_persist_ptr(heap, heap->hdr->root);
+}
+
+void pm_persist_set_root(pm_persist_t *heap, void *ptr) {
+    heap->hdr->root = pm_persist_offset(heap, ptr);
+}
+
+uint64_t pm_persist_offset(pm_persist_t *heap, void *ptr) {
+    if (ptr == NULL)
+        return 0;
+    return (char *)ptr - (char *)heap->hdr;
+}
+
+void *pm_persist_ptr(pm_persist_t *heap, uint64_t offset) {
+    if (offset == 0)
+        return NULL;
+    return (char *)heap->hdr + offset;
+}
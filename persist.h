@@ -0,0 +1,87 @@
+/* heaps kept in a file, which survive the process.
+ *
+ * a persistent heap is one arena whose memory is a MAP_SHARED mapping
+ * of a file. allocations made from it are written to the file, and
+ * reopening the file in a later run brings them back, along with a
+ * root object the application uses to find its data again.
+ *
+ * the file may be mapped at a different address each time it is
+ * opened. the allocator's own seglist links are rebuilt when the file
+ * is opened, so the file never contains pointers that the allocator
+ * relies on. the same goes for application data: links between
+ * objects in the heap should be stored as offsets (pm_persist_offset()
+ * and pm_persist_ptr()), or else kept only while the heap is open.
+ */
+
+#ifndef PERSIST_H_
+#define PERSIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PERSIST_MAGIC    "PMHEAP"
+#define PERSIST_VERSION  1
+
+/* the file starts with one page holding the header. the arena
+ * takes up the rest of the file.
+ */
+#define PERSIST_HEADER_SIZE  4096
+
+/* layout of the header page (native endian). */
+typedef struct persist_header {
+    char magic[8];
+    uint32_t version;
+    /* set when the heap was closed with pm_persist_close(). */
+    uint32_t clean;
+    /* size of the whole file. */
+    uint64_t size;
+    /* address the file was mapped at when it was last opened. */
+    uint64_t base;
+    /* offset of the root object from the start of the file, or 0. */
+    uint64_t root;
+} persist_header_t;
+
+typedef struct pm_persist pm_persist_t;
+
+/* opens the heap in the file at path, creating it with room for size
+ * bytes (rounded up to whole pages) if the file doesn't exist or is
+ * empty. size is ignored for existing heaps. the file stays locked
+ * against other processes while it is open.
+ *
+ * an existing heap is walked and checked before it is handed back. a
+ * heap that wasn't closed cleanly is still opened if it passes the
+ * check; pm_persist_was_clean() tells the application whether to trust
+ * its own data in that case.
+ *
+ * returns NULL with errno set if the file can't be opened, is locked,
+ * or doesn't hold a valid heap (EINVAL).
+ */
+pm_persist_t *pm_persist_open(const char *path, size_t size);
+
+/* flushes the heap to its file, marks it clean and unmaps it. every
+ * pointer into the heap is invalid afterwards.
+ */
+void pm_persist_close(pm_persist_t *heap);
+
+/* flushes the heap to its file without closing it. */
+bool pm_persist_sync(pm_persist_t *heap);
+
+bool pm_persist_was_clean(pm_persist_t *heap);
+
+void *pm_persist_malloc(pm_persist_t *heap, size_t size);
+void pm_persist_free(pm_persist_t *heap, void *ptr);
+
+/* the root object is how the application finds its data again
+ * after reopening a heap. it is NULL in a new heap.
+ */
+void *pm_persist_root(pm_persist_t *heap);
+void pm_persist_set_root(pm_persist_t *heap, void *ptr);
+
+/* conversions between pointers into the heap and offsets, which stay
+ * valid across runs. NULL and offset 0 map to each other.
+ */
+uint64_t pm_persist_offset(pm_persist_t *heap, void *ptr);
+void *pm_persist_ptr(pm_persist_t *heap, uint64_t offset);
+
+#endif
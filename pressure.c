@@ -0,0 +1,237 @@
+/**
+ * @file pressure.c
+ * @brief the memory pressure monitor
+ *
+ * The monitor is the only writer of pm_pressure. Everything else reads
+ * it without synchronization: a thread that sees it late only purges,
+ * or doesn't, one free later than it could have. The cache limits are
+ * also written by pm_ctl(), so the monitor stores them atomically, and
+ * only puts back a limit that still holds the value it set.
+ *
+ * The cgroup files are found once, when the monitor starts. A process
+ * moved to another cgroup afterwards keeps watching the old one.
+ */
+
+#include "pressure.h"
+#include "malloc.h"
+#include "config.h"
+#include "thread_cache.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+bool pm_pressure;
+
+static char limit_path[512];
+static char usage_path[512];
+
+/* the cache limits from before the pressure, and the ones it set. */
+static size_t saved_max_entries;
+static size_t saved_max_size;
+static size_t pressure_max_entries;
+static size_t pressure_max_size;
+
+static pthread_once_t pressure_once = PTHREAD_ONCE_INIT;
+
+/* reads the first number in a file. "max" (no limit) and missing
+ * files read as 0.
+ */
+static unsigned long long read_number(const char *path) {
+    unsigned long long value = 0;
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%llu", &value) != 1)
+            value = 0;
+        fclose(f);
+    }
+    return value;
+}
+
+static bool file_exists(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f)
+        fclose(f);
+    return f != NULL;
+}
+
+/* whether a controller list, "a,b,c:", names the memory controller. */
+static bool has_memory_controller(const char *list) {
+    for (;;) {
+        size_t n = strcspn(list, ",:");
+        if (n == 6 && strncmp(list, "memory", 6) == 0)
+            return true;
+        if (list[n] != ',')
+            return false;
+        list += n + 1;
+    }
+}
+
+/* points limit_path and usage_path at the given files of a cgroup.
+ * returns whether the limit file is there.
+ */
+static bool use_cgroup(const char *dir, const char *cgroup,
+                       const char *limit, const char *usage) {
+    snprintf(limit_path, sizeof(limit_path), "%s%s/%s", dir, cgroup, limit);
+    snprintf(usage_path, sizeof(usage_path), "%s%s/%s", dir, cgroup, usage);
+    return file_exists(limit_path);
+}
+
+/* finds the limit and usage files of the cgroup the process is in.
+ * each line of /proc/self/cgroup is "id:controllers:path": cgroup v2
+ * has the one "0::path", cgroup v1 a line per hierarchy, the memory
+ * controller's among them. inside a cgroup namespace, the path may not
+ * exist under the mount, whose root is then the process's own cgroup.
+ */
+static void find_cgroup(void) {
+    char line[512];
+    char v2[400] = "";
+    char v1[400] = "";
+
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            char *controllers = strchr(line, ':');
+            char *path = controllers ? strchr(controllers + 1, ':') : NULL;
+            if (!path)
+                continue;
+            controllers++;
+            path++;
+            path[strcspn(path, "\n")] = '\0';
+
+            if (strncmp(line, "0::", 3) == 0)
+                snprintf(v2, sizeof(v2), "%s", path);
+            else if (has_memory_controller(controllers))
+                snprintf(v1, sizeof(v1), "%s", path);
+        }
+        fclose(f);
+    }
+    if (strcmp(v2, "/") == 0)
+        v2[0] = '\0';
+    if (strcmp(v1, "/") == 0)
+        v1[0] = '\0';
+
+    if (use_cgroup(PRESSURE_CGROUP_ROOT, v2, "memory.max", "memory.current"))
+        return;
+    if (use_cgroup(PRESSURE_CGROUP_ROOT "/memory", v1,
+                   "memory.limit_in_bytes", "memory.usage_in_bytes"))
+        return;
+    use_cgroup(PRESSURE_CGROUP_ROOT "/memory", "",
+               "memory.limit_in_bytes", "memory.usage_in_bytes");
+}
+
+/* the "some avg10" figure: the share of the last ten seconds, in
+ * percent, in which some task stalled on memory.
+ */
+static float read_psi(void) {
+    float avg10 = 0;
+    FILE *f = fopen(PRESSURE_PSI_PATH, "r");
+    if (f) {
+        if (fscanf(f, "some avg10=%f", &avg10) != 1)
+            avg10 = 0;
+        fclose(f);
+    }
+    return avg10;
+}
+
+/* the cgroup's usage over its limit, or 0 without a limit. */
+static float read_usage(void) {
+    unsigned long long limit = read_number(limit_path);
+    if (limit == 0)
+        return 0;
+    return (float)read_number(usage_path) / limit;
+}
+
+/* lowers one cache limit to cap, and remembers what it was and what
+ * it was set to.
+ */
+static void lower_limit(size_t *limit, size_t cap, size_t *saved,
+                        size_t *set) {
+    *saved = __atomic_load_n(limit, __ATOMIC_RELAXED);
+    *set = *saved > cap ? cap : *saved;
+    __atomic_store_n(limit, *set, __ATOMIC_RELAXED);
+}
+
+/* puts a cache limit back, unless pm_ctl() changed it in the meantime. */
+static void restore_limit(size_t *limit, size_t saved, size_t set) {
+    __atomic_compare_exchange_n(limit, &set, saved, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static void enter_pressure(void) {
+    __atomic_store_n(&pm_pressure, true, __ATOMIC_RELAXED);
+
+    lower_limit(&pm_config.cache_max_entries, PRESSURE_CACHE_MAX_ENTRIES,
+                &saved_max_entries, &pressure_max_entries);
+    lower_limit(&pm_config.cache_max_size, PRESSURE_CACHE_MAX_SIZE,
+                &saved_max_size, &pressure_max_size);
+
+    arena_cached_flush_caches();
+    pm_purge();
+}
+
+static void leave_pressure(void) {
+    restore_limit(&pm_config.cache_max_entries, saved_max_entries,
+                  pressure_max_entries);
+    restore_limit(&pm_config.cache_max_size, saved_max_size,
+                  pressure_max_size);
+
+    __atomic_store_n(&pm_pressure, false, __ATOMIC_RELAXED);
+}
+
+/* whether either reading is at or above percent of its threshold.
+ * a threshold of 0 is off.
+ */
+static bool over(float psi, float usage, int percent) {
+    float psi_threshold = pm_config.pressure_psi_threshold;
+    float usage_threshold = pm_config.pressure_limit_ratio;
+
+    return (psi_threshold > 0 && psi >= psi_threshold * percent / 100) ||
+           (usage_threshold > 0 && usage >= usage_threshold * percent / 100);
+}
+
+static void *monitor(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        float psi = read_psi();
+        float usage = read_usage();
+
+        if (!pm_pressure && over(psi, usage, 100))
+            enter_pressure();
+        else if (pm_pressure && !over(psi, usage, PRESSURE_EXIT_PERCENT))
+            leave_pressure();
+
+        size_t ms = pm_config.pressure_interval_ms;
+        struct timespec pause = { ms / 1000, (ms % 1000) * 1000000 };
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+size_t pm_purge(void) {
+    size_t purged = 0;
+    for (int i = 0; i < arena_count(); i++) {
+        arena_t *arena = get_arena_at(i);
+        purged += arena_purge(arena);
+        release_arena(arena);
+    }
+    return purged;
+}
+
+static void start_monitor(void) {
+    find_cgroup();
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, monitor, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+void pressure_start(void) {
+    if (pm_config.pressure_interval_ms)
+        pthread_once(&pressure_once, start_monitor);
+}
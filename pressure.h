@@ -0,0 +1,65 @@
+/* memory pressure response.
+ *
+ * when the "pressure_interval_ms" tunable is set, a monitor thread
+ * reads the memory pressure stall information (/proc/pressure/memory)
+ * and the cgroup's memory.current against memory.max that often. the
+ * allocator is under pressure while either one crosses its threshold:
+ * "some avg10" at or above pressure_psi_threshold percent, or usage at
+ * or above pressure_limit_ratio of the limit.
+ *
+ * on entering pressure, the allocator:
+ *   - lowers the cache_max_entries and cache_max_size tunables to
+ *     PRESSURE_CACHE_MAX_ENTRIES and PRESSURE_CACHE_MAX_SIZE,
+ *   - has every thread flush its cache the next time it allocates or
+ *     frees (see arena_cached_flush_caches()),
+ *   - and purges the free memory of every arena (see pm_purge()).
+ * until the pressure is over, every free purges whatever whole pages
+ * its block leaves free, unless pm_freex() is told
+ * PM_MALLOCX_NO_PURGE. once both readings have dropped below
+ * PRESSURE_EXIT_PERCENT of their thresholds, the cache limits go back
+ * to what they were.
+ *
+ * a cgroup v1 memory controller (memory.limit_in_bytes and
+ * memory.usage_in_bytes of the process's own memory cgroup) is used
+ * when there is no cgroup v2 one. the cache limits are only put back
+ * if pm_ctl() hasn't changed them while the pressure lasted.
+ */
+
+#ifndef PRESSURE_H_
+#define PRESSURE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* how far below its thresholds the pressure has to fall before the
+ * allocator goes back to normal, so that it doesn't flap.
+ */
+#define PRESSURE_EXIT_PERCENT  75
+
+#define PRESSURE_PSI_PATH  "/proc/pressure/memory"
+#define PRESSURE_CGROUP_ROOT  "/sys/fs/cgroup"
+
+/* set while the allocator is under pressure. */
+extern bool pm_pressure;
+
+/* gives the whole pages inside every arena's free blocks, and past
+ * every arena's heap, back to the system. returns the bytes purged
+ * from free blocks.
+ * runs on its own whenever pressure sets in.
+ */
+size_t pm_purge(void);
+
+/* called by arenas_init(). starts the monitor if the
+ * pressure_interval_ms tunable is set.
+ */
+void pressure_start(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
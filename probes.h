@@ -0,0 +1,45 @@
+/* user-space static tracepoints (USDT) on the allocator's hot paths.
+ *
+ * they are emitted whenever <sys/sdt.h>, from systemtap's sdt
+ * development package, is installed. each probe is then a single nop
+ * in the instruction stream plus a note in the binary, which bpftrace
+ * and perf can find and attach to at runtime, e.g.
+ *
+ *     bpftrace -e 'usdt:./a.out:pmalloc:cache_miss { @[arg0] = count(); }'
+ *
+ * without the header, or when built with -D PM_NO_USDT, the probes
+ * compile away completely. -D PM_USDT insists on them, and fails the
+ * build if the header is missing.
+ *
+ * provider "pmalloc", probes and their arguments:
+ *   cache_hit(size, block)          arena_cached_malloc() served from cache
+ *   cache_miss(size)                arena_cached_malloc() fell through
+ *   cache_evict(block, size)        arena_cached_free() evicted a block
+ *   arena_acquire(arena)            an arena lock was taken
+ *   arena_release(arena)            an arena lock was released
+ *   arena_extend(arena, size)       an allocator grew an arena's heap
+ *   coalesce(arena, block, size)    coalesce_block() merged into block
+ */
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+#if !defined(PM_USDT) && !defined(PM_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PM_USDT
+#endif
+#endif
+
+#if defined(PM_USDT) && !defined(PM_NO_USDT)
+#include <sys/sdt.h>
+
+#define PM_PROBE1(name, a)        DTRACE_PROBE1(pmalloc, name, a)
+#define PM_PROBE2(name, a, b)     DTRACE_PROBE2(pmalloc, name, a, b)
+#define PM_PROBE3(name, a, b, c)  DTRACE_PROBE3(pmalloc, name, a, b, c)
+#else
+#define PM_PROBE1(name, a)        ((void)0)
+#define PM_PROBE2(name, a, b)     ((void)0)
+#define PM_PROBE3(name, a, b, c)  ((void)0)
+#endif
+
+#endif
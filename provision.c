@@ -0,0 +1,135 @@
+/**
+ * @file provision.c
+ * @brief the provisioner thread
+ *
+ * For each arena, provisioned[i] is how far past the heap its pages
+ * are known to be faulted in. Only the provisioner reads or writes
+ * it. heap_end is read without the arena lock: it only ever grows, so
+ * a stale value just means the arena gets topped up a round later.
+ *
+ * MADV_POPULATE_WRITE faults pages in as a write would, without
+ * changing what is in them, so it is safe on the page the heap ends
+ * in even while the heap is being written. Without it, the pages are
+ * written to with the arena lock held, and only past heap_end, where
+ * nothing lives.
+ */
+
+#include "provision.h"
+#include "malloc.h"
+#include "config.h"
+#include "pressure.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* older libc headers don't have it (added in Linux 5.14). */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE  23
+#endif
+
+static char **provisioned;
+static size_t page_size;
+static bool populate_unsupported;
+
+static pthread_once_t provision_once = PTHREAD_ONCE_INIT;
+
+/* faults in [from, to) of the arena at index by writing to it. */
+static void touch_pages(int index, char *from, char *to) {
+    for (char *batch = from; batch < to; batch += PROVISION_TOUCH_BATCH) {
+        char *stop = batch + PROVISION_TOUCH_BATCH;
+        if (stop > to)
+            stop = to;
+
+        arena_t *arena = get_arena_at(index);
+        char *end = arena->heap_end;
+        for (char *page = batch; page < stop; page += page_size) {
+            if (page + page_size <= end)
+                continue;
+            *(volatile char *)(page < end ? end : page) = 0;
+        }
+        release_arena(arena);
+    }
+}
+
+static void populate(int index, char *from, char *to) {
+    if (!populate_unsupported &&
+        madvise(from, to - from, MADV_POPULATE_WRITE) == 0)
+        return;
+
+    /* EINVAL is an old kernel. anything else (EAGAIN, ENOMEM) leaves
+     * the pages to be faulted in when the heap gets there.
+     */
+    if (populate_unsupported || errno == EINVAL) {
+        populate_unsupported = true;
+        touch_pages(index, from, to);
+    }
+}
+
+static void provision_arena(int index, size_t headroom) {
+    /* purging under pressure gives back what was faulted in, and
+     * faulting in more would only add to the pressure.
+     */
+    if (pm_pressure) {
+        provisioned[index] = NULL;
+        return;
+    }
+
+    arena_t *arena = arena_at(index);
+    char *end = __atomic_load_n((char **)&arena->heap_end, __ATOMIC_RELAXED);
+    char *limit = (char *)arena->low + arena->size;
+    char *done = provisioned[index];
+
+    if (done > end && (size_t)(done - end) > headroom / 2)
+        return;
+
+    char *from = (char *)((uintptr_t)end & ~(page_size - 1));
+    if (from < done)
+        from = done;
+    char *to = (char *)(((uintptr_t)end + headroom + page_size - 1) &
+                        ~(page_size - 1));
+    if (to > limit)
+        to = limit;
+    if (from >= to)
+        return;
+
+    populate(index, from, to);
+    provisioned[index] = to;
+}
+
+static void *provisioner(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        for (int i = 0; i < arena_count(); i++)
+            provision_arena(i, pm_config.provision_headroom);
+
+        struct timespec pause = { 0, PROVISION_INTERVAL_US * 1000 };
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+static void start_provisioner(void) {
+    page_size = sysconf(_SC_PAGESIZE);
+    provisioned = map_region(arena_count() * sizeof(char *),
+                             "pmalloc:provision");
+    if (provisioned == NULL)
+        return;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, provisioner, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+void provision_start(void) {
+    if (pm_config.provision_headroom)
+        pthread_once(&provision_once, start_provisioner);
+}
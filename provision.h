@@ -0,0 +1,35 @@
+/* memory provisioned ahead of demand by a background thread.
+ *
+ * an arena's mapping is reserved up front, but its pages are only
+ * faulted in when the heap grows into them, which happens under the
+ * arena lock: extend_arena_heap() writes the new block's header and
+ * the epilogue into memory nobody has touched yet. when the
+ * "provision_headroom" tunable is set, a provisioner thread keeps
+ * that much memory past each arena's heap_end faulted in, so the
+ * page faults are taken by it instead of by whoever holds the lock.
+ *
+ * the provisioner never changes an arena's heap. it only faults in
+ * pages the heap will grow into, so it needs no arena lock, except on
+ * kernels without MADV_POPULATE_WRITE (Linux 5.14), where it has to
+ * write to the pages to fault them in.
+ */
+
+#ifndef PROVISION_H_
+#define PROVISION_H_
+
+/* how often the provisioner looks at the arenas. it tops an arena
+ * back up once less than half of its headroom is left.
+ */
+#define PROVISION_INTERVAL_US  1000
+
+/* bytes faulted in per arena lock hold, when the pages have to be
+ * written to.
+ */
+#define PROVISION_TOUCH_BATCH  (64 * 1024)
+
+/* called by arenas_init(). starts the provisioner if the
+ * provision_headroom tunable is set.
+ */
+void provision_start(void);
+
+#endif
@@ -0,0 +1,188 @@
+/**
+ * @file reclaim.c
+ * @brief deferred frees and the reclaimer thread
+ *
+ * Each ring has one producer, the thread that owns it, and one
+ * consumer, the reclaimer, so it needs no lock: the producer only
+ * writes tail and the consumer only writes head, each published with
+ * a release store. Rings live in a static table rather than in thread
+ * local storage, so that a ring whose thread has exited can still be
+ * drained; the reclaimer hands the slot back once it is empty.
+ *
+ * The reclaimer sleeps on a semaphore with a timeout. A producer posts
+ * it when its ring passes three quarters full, which is the only time
+ * a free here does more than a few stores.
+ */
+
+#include "reclaim.h"
+#include "malloc.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <time.h>
+
+typedef struct reclaim_ring {
+    /* RING_OWNED while its thread lives, then RING_ORPHANED until the
+     * reclaimer has drained it, then RING_FREE.
+     */
+    int state;
+
+    /* the producer's end, and the consumer's end on its own cache line. */
+    size_t tail __attribute__((aligned(64)));
+    size_t head __attribute__((aligned(64)));
+
+    void *slots[RECLAIM_RING_SIZE];
+} reclaim_ring_t;
+
+enum {
+    RING_FREE,
+    RING_OWNED,
+    RING_ORPHANED
+};
+
+static reclaim_ring_t rings[RECLAIM_MAX_RINGS];
+static sem_t wakeup;
+
+static __thread reclaim_ring_t *thread_ring;
+static __thread bool thread_no_ring;
+
+static pthread_key_t reclaim_exit_key;
+static pthread_once_t reclaim_start_once = PTHREAD_ONCE_INIT;
+
+/* frees everything queued on ring, and returns how many blocks that
+ * was. head only moves once they are freed, so that
+ * pm_free_async_flush() doesn't return early.
+ */
+static size_t drain(reclaim_ring_t *ring, void **ptrs) {
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t n = tail - head;
+
+    for (size_t i = 0; i < n; i++)
+        ptrs[i] = ring->slots[(head + i) % RECLAIM_RING_SIZE];
+    arena_cached_free_batch(ptrs, n);
+    __atomic_store_n(&ring->head, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+static void *reclaimer(void *arg) {
+    (void)arg;
+    void *ptrs[RECLAIM_RING_SIZE];
+
+    /* unused, but the debug heap checks look at it. */
+    init_tcache();
+
+    for (;;) {
+        size_t freed = 0;
+        for (int i = 0; i < RECLAIM_MAX_RINGS; i++) {
+            reclaim_ring_t *ring = &rings[i];
+            int state = __atomic_load_n(&ring->state, __ATOMIC_ACQUIRE);
+            if (state == RING_FREE)
+                continue;
+
+            freed += drain(ring, ptrs);
+
+            /* the owner is gone, so nothing more can arrive. */
+            if (state == RING_ORPHANED && ring->head == ring->tail)
+                __atomic_store_n(&ring->state, RING_FREE, __ATOMIC_RELEASE);
+        }
+        if (freed)
+            continue;
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += RECLAIM_IDLE_US * 1000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        while (sem_timedwait(&wakeup, &until) != 0 && errno == EINTR)
+            ;
+    }
+    return NULL;
+}
+
+static void reclaim_thread_exit(void *arg) {
+    reclaim_ring_t *ring = arg;
+
+    /* frees from destructors that run after this one are done right
+     * away, since the ring may belong to another thread by then.
+     */
+    thread_ring = NULL;
+    thread_no_ring = true;
+
+    __atomic_store_n(&ring->state, RING_ORPHANED, __ATOMIC_RELEASE);
+    sem_post(&wakeup);
+}
+
+static void start_reclaimer(void) {
+    sem_init(&wakeup, 0, 0);
+    pthread_key_create(&reclaim_exit_key, reclaim_thread_exit);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, reclaimer, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+/* claims a free ring for the calling thread. returns NULL if there
+ * is none left.
+ */
+static reclaim_ring_t *claim_ring(void) {
+    pthread_once(&reclaim_start_once, start_reclaimer);
+
+    for (int i = 0; i < RECLAIM_MAX_RINGS; i++) {
+        int expected = RING_FREE;
+        if (__atomic_compare_exchange_n(&rings[i].state, &expected,
+                                        RING_OWNED, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+            pthread_setspecific(reclaim_exit_key, &rings[i]);
+            return &rings[i];
+        }
+    }
+    return NULL;
+}
+
+void pm_free_async(void *ptr) {
+    if (ptr == NULL)
+        return;
+
+    reclaim_ring_t *ring = thread_ring;
+    if (!ring && !thread_no_ring) {
+        ring = thread_ring = claim_ring();
+        thread_no_ring = ring == NULL;
+    }
+
+    arena_cached_release(ptr);
+
+    size_t tail = ring ? ring->tail : 0;
+    size_t queued = ring ? tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+                         : RECLAIM_RING_SIZE;
+    if (queued == RECLAIM_RING_SIZE) {
+        /* no room: this one is freed here after all. */
+        arena_cached_free_batch(&ptr, 1);
+        return;
+    }
+
+    ring->slots[tail % RECLAIM_RING_SIZE] = ptr;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (queued + 1 == RECLAIM_RING_SIZE * 3 / 4)
+        sem_post(&wakeup);
+}
+
+void pm_free_async_flush(void) {
+    reclaim_ring_t *ring = thread_ring;
+    if (!ring)
+        return;
+
+    while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) {
+        sem_post(&wakeup);
+        struct timespec pause = { 0, 100 * 1000 };
+        nanosleep(&pause, NULL);
+    }
+}
@@ -0,0 +1,39 @@
+/* frees finished by a background thread.
+ *
+ * pm_free_async() does only the freeing thread's share of a free (see
+ * arena_cached_release()), and queues the block on a ring of the
+ * thread's own. a reclaimer thread, started on first use, drains the
+ * rings and frees their blocks back to the arenas, grouped so that it
+ * takes each arena's lock once per batch. the arena locks, and the
+ * coalescing done under them, then stay off the freeing thread.
+ *
+ * blocks freed this way skip the thread cache. they must come from
+ * arena_cached_malloc() or pm_mallocx(), like for arena_cached_free().
+ */
+
+#ifndef RECLAIM_H_
+#define RECLAIM_H_
+
+#include <stddef.h>
+
+/* blocks a thread can have queued. when its ring is full, a free is
+ * done right away instead.
+ */
+#define RECLAIM_RING_SIZE  512
+
+/* threads that can have a ring at once. threads beyond that free
+ * right away.
+ */
+#define RECLAIM_MAX_RINGS  64
+
+/* how long the reclaimer sleeps when it finds nothing to free, unless
+ * a ring filling up wakes it sooner.
+ */
+#define RECLAIM_IDLE_US  1000
+
+void pm_free_async(void *ptr);
+
+/* waits until everything the calling thread has queued is freed. */
+void pm_free_async_flush(void);
+
+#endif
@@ -0,0 +1,61 @@
+/**
+ * @file region.c
+ * @brief heaps over caller-supplied memory
+ *
+ * The buffer is split into a pm_region_t (the arena_t and its lock)
+ * at the 16-byte aligned start, and the arena's memory after it, which
+ * arena_format() lays out like any mapped arena. Extending the heap
+ * then only moves heap_end within the buffer (see extend_arena()), so
+ * no call here or in the arena code ever maps memory.
+ */
+
+#include "region.h"
+#include "malloc.h"
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+
+struct pm_region {
+    arena_t arena;
+};
+
+pm_region_t *pm_region_init(void *mem, size_t size) {
+    pm_config_init();
+
+    uintptr_t start = ((uintptr_t)mem + dsize - 1) & ~(uintptr_t)(dsize - 1);
+    size_t skip = start - (uintptr_t)mem;
+    size_t header = (sizeof(pm_region_t) + dsize - 1) & ~(dsize - 1);
+
+    /* the prologue and epilogue, and at least one block. */
+    if (mem == NULL || size < skip + header + 2 * wsize + min_block_size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pm_region_t *region = (pm_region_t *)start;
+    pthread_mutex_init(&region->arena.lock, NULL);
+    arena_format(&region->arena, (char *)start + header, size - skip - header);
+    return region;
+}
+
+void pm_region_destroy(pm_region_t *region) {
+    pthread_mutex_destroy(&region->arena.lock);
+}
+
+void *pm_region_malloc(pm_region_t *region, size_t size) {
+    pthread_mutex_lock(&region->arena.lock);
+    void *ptr = arena_malloc_in(&region->arena, size);
+    pthread_mutex_unlock(&region->arena.lock);
+    return ptr;
+}
+
+void pm_region_free(pm_region_t *region, void *ptr) {
+    pthread_mutex_lock(&region->arena.lock);
+    arena_free_in(&region->arena, ptr);
+    pthread_mutex_unlock(&region->arena.lock);
+}
+
+bool pm_region_owns(pm_region_t *region, void *ptr) {
+    return ptr >= region->arena.heap_start && ptr < region->arena.heap_end;
+}
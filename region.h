@@ -0,0 +1,38 @@
+/* heaps in memory the caller already has.
+ *
+ * pm_region_init() turns a buffer (static memory, a hugetlbfs mapping,
+ * memory the application has pinned or registered for DMA) into a heap
+ * with a single arena. the allocator never maps or unmaps anything for
+ * it: the arena's bookkeeping is kept at the start of the buffer, and
+ * the heap grows through the rest of it.
+ */
+
+#ifndef REGION_H_
+#define REGION_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct pm_region pm_region_t;
+
+/* lays out an empty heap in [mem, mem + size). the start is rounded
+ * up to 16 bytes. returns NULL if the buffer is too small to hold the
+ * bookkeeping and one block.
+ */
+pm_region_t *pm_region_init(void *mem, size_t size);
+
+/* stops using the buffer. the caller is free to reuse or release it
+ * afterwards; nothing allocated from it may be used any more.
+ */
+void pm_region_destroy(pm_region_t *region);
+
+/* these return NULL once the buffer is used up; a region never
+ * grows beyond the buffer it was given.
+ */
+void *pm_region_malloc(pm_region_t *region, size_t size);
+void pm_region_free(pm_region_t *region, void *ptr);
+
+/* true if ptr points into the part of the buffer the heap uses. */
+bool pm_region_owns(pm_region_t *region, void *ptr);
+
+#endif
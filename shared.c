@@ -0,0 +1,265 @@
+/**
+ * @file shared.c
+ * @brief heaps in shared memory, for allocation across processes
+ *
+ * The first page of the segment holds a pm_shared_t: the header fields
+ * and the arena_t itself, whose lock is process-shared and robust. The
+ * rest of the segment is the arena's memory, laid out by arena_format()
+ * like any other arena. Everything is then done with the usual arena
+ * code, under that one lock.
+ *
+ * Segments are mapped from SHARED_BASE up rather than wherever mmap()
+ * likes: the kernel's choice is randomized per process, so another
+ * process would usually find that address taken by its own libraries
+ * or heap.
+ *
+ * A process that dies with the lock held may leave a block half
+ * written. The next locker gets EOWNERDEAD and runs arena_recover(),
+ * which rebuilds the seglists from the implicit list and checks the
+ * heap. Only if that passes is the lock marked consistent again;
+ * otherwise the heap is flagged broken and left unrecoverable.
+ */
+
+#include "shared.h"
+#include "malloc.h"
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* older libc headers don't have this (added in Linux 4.17). kernels
+ * that don't know it treat the address as a hint, which is caught by
+ * comparing the result.
+ */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE  0x100000
+#endif
+
+struct pm_shared {
+    /* written last by the creator, so a segment with a magic
+     * is fully set up.
+     */
+    char magic[8];
+    uint32_t version;
+    /* set once a dead lock holder left the heap damaged. */
+    uint32_t broken;
+    /* size of the whole segment. */
+    uint64_t size;
+    /* address every process maps the segment at. */
+    uint64_t base;
+    /* offset of the root object from the start of the segment, or 0. */
+    uint64_t root;
+    /* seglist classes depend on this, so all processes must agree. */
+    uint64_t maxlists;
+
+    arena_t arena;
+};
+
+/* maps the segment at exactly base, or fails with EADDRINUSE. */
+static void *map_at(int fd, void *base, size_t size) {
+    void *mem = mmap(base, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (mem == base)
+        return mem;
+
+    if (mem != MAP_FAILED)
+        munmap(mem, size);
+    if (mem != MAP_FAILED || errno == EEXIST)
+        errno = EADDRINUSE;
+    return MAP_FAILED;
+}
+
+pm_shared_t *pm_shared_create(const char *name, size_t size) {
+    pm_config_init();
+
+    size_t page = SHARED_HEADER_SIZE;
+    size = (size + page - 1) / page * page;
+    if (size < SHARED_HEADER_SIZE + CHUNK_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return NULL;
+
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        for (int i = 0; i < SHARED_BASE_TRIES && mem == MAP_FAILED; i++)
+            mem = map_at(fd, (char *)SHARED_BASE + i * size, size);
+    }
+    int saved_errno = errno;
+    close(fd);
+    if (mem == MAP_FAILED) {
+        shm_unlink(name);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    /* the segment starts out zeroed. */
+    pm_shared_t *heap = mem;
+    heap->version = SHARED_VERSION;
+    heap->size = size;
+    heap->base = (uintptr_t)mem;
+    heap->maxlists = pm_config.maxlists;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&heap->arena.lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    arena_format(&heap->arena, (char *)mem + SHARED_HEADER_SIZE,
+                 size - SHARED_HEADER_SIZE);
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(heap->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC));
+    return heap;
+}
+
+/* true if the segment called name is already mapped at base in this
+ * process, e.g. because this process was forked after creating or
+ * opening it. shm segments show up as /dev/shm/<name> in the maps.
+ */
+static bool mapped_here(void *base, const char *name) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps)
+        return false;
+
+    char line[512];
+    char path[256];
+    unsigned long start;
+    size_t name_len = strlen(name);
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), maps)) {
+        if (sscanf(line, "%lx-%*x %*s %*s %*s %*s %255s", &start, path) != 2)
+            continue;
+        size_t path_len = strlen(path);
+        found = start == (uintptr_t)base && path_len >= name_len &&
+                strcmp(path + path_len - name_len, name) == 0;
+    }
+    fclose(maps);
+    return found;
+}
+
+pm_shared_t *pm_shared_open(const char *name) {
+    pm_config_init();
+
+    int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    pm_shared_t hdr;
+    int err = 0;
+    if (fstat(fd, &st) < 0) {
+        err = errno;
+    } else if ((size_t)st.st_size < sizeof(hdr) ||
+               pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+               hdr.magic[0] == '\0') {
+        err = EAGAIN;
+    } else if (memcmp(hdr.magic, SHARED_MAGIC, sizeof(SHARED_MAGIC)) != 0 ||
+               hdr.version != SHARED_VERSION ||
+               hdr.size != (uint64_t)st.st_size ||
+               hdr.maxlists != pm_config.maxlists) {
+        err = EINVAL;
+    }
+    if (err != 0) {
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    void *base = (void *)(uintptr_t)hdr.base;
+    if (mapped_here(base, name)) {
+        close(fd);
+        return base;
+    }
+
+    void *mem = map_at(fd, base, hdr.size);
+    int saved_errno = errno;
+    close(fd);
+    if (mem == MAP_FAILED) {
+        errno = saved_errno;
+        return NULL;
+    }
+    return mem;
+}
+
+void pm_shared_close(pm_shared_t *heap) {
+    munmap(heap, heap->size);
+}
+
+bool pm_shared_unlink(const char *name) {
+    return shm_unlink(name) == 0;
+}
+
+/* takes the heap's lock, recovering the heap first if the last
+ * holder died. returns false (without the lock) if the heap is
+ * damaged.
+ */
+static bool lock_heap(pm_shared_t *heap) {
+    int err = pthread_mutex_lock(&heap->arena.lock);
+    if (err == EOWNERDEAD) {
+        if (!heap->broken && arena_recover(&heap->arena)) {
+            pthread_mutex_consistent(&heap->arena.lock);
+            return true;
+        }
+        /* unlocking without marking the lock consistent makes it
+         * unrecoverable, so every later locker fails straight away.
+         */
+        heap->broken = true;
+        pthread_mutex_unlock(&heap->arena.lock);
+        return false;
+    }
+    if (err != 0)
+        return false;
+
+    if (heap->broken) {
+        pthread_mutex_unlock(&heap->arena.lock);
+        return false;
+    }
+    return true;
+}
+
+void *pm_shared_malloc(pm_shared_t *heap, size_t size) {
+    if (!lock_heap(heap))
+        return NULL;
+    void *ptr = arena_malloc_in(&heap->arena, size);
+    pthread_mutex_unlock(&heap->arena.lock);
+    return ptr;
+}
+
+void pm_shared_free(pm_shared_t *heap, void *ptr) {
+    if (ptr == NULL || !lock_heap(heap))
+        return;
+    arena_free_in(&heap->arena, ptr);
+    pthread_mutex_unlock(&heap->arena.lock);
+}
+
+void *pm_shared_root(pm_shared_t *heap) {
+    return pm_shared_ptr(heap, __atomic_load_n(&heap->root, __ATOMIC_ACQUIRE));
+}
+
+void pm_shared_set_root(pm_shared_t *heap, void *ptr) {
+    __atomic_store_n(&heap->root, pm_shared_offset(heap, ptr), __ATOMIC_RELEASE);
+}
+
+uint64_t pm_shared_offset(pm_shared_t *heap, void *ptr) {
+    if (ptr == NULL)
+        return 0;
+    return (char *)ptr - (char *)heap;
+}
+
+void *pm_shared_ptr(pm_shared_t *heap, uint64_t offset) {
+    if (offset == 0)
+        return NULL;
+    return (char *)heap + offset;
+}
@@ -0,0 +1,95 @@
+/* heaps shared between processes.
+ *
+ * a shared heap is one arena in a POSIX shared memory segment
+ * (shm_open()), together with the arena's bookkeeping and a lock that
+ * works across processes. cooperating processes that open the same
+ * segment can allocate objects in it, hand out pointers to each other,
+ * and free objects that another process allocated.
+ *
+ * the arena is a standalone one: it is not in the arena table, so
+ * malloc() never hands out its memory, and it has no thread caches.
+ * only the pm_shared_*() calls below allocate from it.
+ *
+ * the arena's seglists are plain pointers into the segment, so every
+ * process maps the segment at the same fixed address.
+ * pm_shared_create() picks the first free one of SHARED_BASE_TRIES
+ * slots from SHARED_BASE up, an address range far from where the
+ * kernel places mappings by itself. processes forked after
+ * pm_shared_create() inherit that mapping; unrelated processes map the
+ * segment at the address it was created at, and pm_shared_open() fails
+ * with EADDRINUSE if something else is there already (an ASLR layout
+ * can still put a mapping anywhere). object pointers are therefore
+ * valid in every process that has the heap open; pm_shared_offset()
+ * and pm_shared_ptr() are there for data that must not depend on that.
+ *
+ * the lock is robust: if a process dies while holding it, the next
+ * process to take it rebuilds and checks the heap before carrying on.
+ * if the heap turns out to be damaged, every later call on it fails.
+ */
+
+#ifndef SHARED_H_
+#define SHARED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SHARED_MAGIC    "PMSHM"
+#define SHARED_VERSION  1
+
+/* the segment starts with one page holding the header and the arena
+ * bookkeeping. the arena takes up the rest of the segment.
+ */
+#define SHARED_HEADER_SIZE  4096
+
+/* where shared heaps are mapped, and how many segment-sized slots from
+ * there pm_shared_create() tries before failing with EADDRINUSE.
+ */
+#define SHARED_BASE        ((uintptr_t)1 << 44)
+#define SHARED_BASE_TRIES  64
+
+typedef struct pm_shared pm_shared_t;
+
+/* creates a new segment called name (see shm_open()) with room for
+ * size bytes, rounded up to whole pages. fails with EEXIST if the
+ * segment already exists, and EADDRINUSE if none of the slots from
+ * SHARED_BASE up is free.
+ */
+pm_shared_t *pm_shared_create(const char *name, size_t size);
+
+/* opens a segment made by pm_shared_create(), in this or another
+ * process. fails with EAGAIN if the creator hasn't finished setting it
+ * up, EADDRINUSE if its address is taken here, and EINVAL if it isn't
+ * a shared heap or was made with a different "maxlists" tunable.
+ */
+pm_shared_t *pm_shared_open(const char *name);
+
+/* unmaps the heap from this process. the segment and its objects
+ * stay around until pm_shared_unlink() and the last close. a process
+ * that opened a heap more than once (or forked with it open) shares
+ * one mapping between those handles, so it should close it once.
+ */
+void pm_shared_close(pm_shared_t *heap);
+
+/* removes the segment's name, as shm_unlink() does. */
+bool pm_shared_unlink(const char *name);
+
+/* both return NULL / do nothing once the heap has been found
+ * damaged (see above).
+ */
+void *pm_shared_malloc(pm_shared_t *heap, size_t size);
+void pm_shared_free(pm_shared_t *heap, void *ptr);
+
+/* an object every process can find, e.g. a queue or a directory of
+ * the other objects. it is NULL in a new heap.
+ */
+void *pm_shared_root(pm_shared_t *heap);
+void pm_shared_set_root(pm_shared_t *heap, void *ptr);
+
+/* conversions between pointers into the heap and offsets from the
+ * start of the segment. NULL and offset 0 map to each other.
+ */
+uint64_t pm_shared_offset(pm_shared_t *heap, void *ptr);
+void *pm_shared_ptr(pm_shared_t *heap, uint64_t offset);
+
+#endif
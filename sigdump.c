@@ -0,0 +1,198 @@
+/**
+ * @file sigdump.c
+ * @brief dumps allocator state from a signal handler
+ *
+ * Everything the handler needs is set up when it is installed: the
+ * output buffer is mapped and the path is copied. The handler itself
+ * formats numbers by hand and only calls open(), write(), close() and
+ * getpid(), all of which are async-signal-safe.
+ *
+ * The handler can't take arena locks (the interrupted thread may hold
+ * one), so it reads arenas as they are. If other threads keep
+ * allocating, the numbers for an arena may be slightly torn, and
+ * seglist walks stop as soon as they leave the arena.
+ */
+
+#include "sigdump.h"
+#include "malloc.h"
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+static char *dump_buf = NULL;
+static size_t dump_len;
+static bool dump_truncated;
+static char dump_path[256];
+
+/* set while a dump is in progress, so that nested signals are dropped. */
+static int dumping = 0;
+
+/* room kept at the end of the buffer for the truncation notice. */
+static const size_t dump_reserve = 64;
+
+static void put_str(const char *s) {
+    size_t len = strlen(s);
+    if (dump_len + len > SIGDUMP_BUFFER_SIZE - dump_reserve) {
+        dump_truncated = true;
+        return;
+    }
+    memcpy(dump_buf + dump_len, s, len);
+    dump_len += len;
+}
+
+static void put_num(uint64_t value, unsigned base) {
+    char digits[24];
+    int i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do {
+        digits[--i] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value != 0);
+
+    if (base == 16)
+        put_str("0x");
+    put_str(&digits[i]);
+}
+
+static void put_field(const char *name, uint64_t value) {
+    put_str(name);
+    put_num(value, 10);
+}
+
+static bool in_arena(arena_t *arena, block_t *block) {
+    return (void *)block >= arena->heap_start &&
+           (void *)block < arena->heap_end;
+}
+
+static void dump_arena(int index, arena_t *arena) {
+    put_field("arena ", index);
+    if (!arena->heap_start) {
+        put_str(": unmapped\n");
+        return;
+    }
+
+    size_t heap_size = (char *)arena->heap_end - (char *)arena->heap_start;
+    size_t free_bytes = 0;
+    size_t free_blocks = 0;
+
+    put_str(" at ");
+    put_num((uintptr_t)arena->low, 16);
+    put_field(": heap ", heap_size);
+    put_field(" of ", arena->size);
+    put_str(" bytes\n");
+
+    for (size_t i = 0; i < SEGLIST_CAPACITY; i++) {
+        size_t count = 0;
+        size_t bytes = 0;
+        bool torn = false;
+
+        for (block_t *block = arena->seglists[i]; block != NULL;
+             block = block->nextBlockInList) {
+            if (!in_arena(arena, block) || count == SIGDUMP_MAX_WALK) {
+                torn = true;
+                break;
+            }
+            count++;
+            bytes += get_size(block);
+        }
+        if (count == 0 && !torn)
+            continue;
+
+        put_field("  list ", i);
+        put_field(": ", count);
+        put_field(" blocks, ", bytes);
+        put_str(torn ? " bytes (changed during dump)\n" : " bytes\n");
+        free_blocks += count;
+        free_bytes += bytes;
+    }
+
+    put_field("  free ", free_bytes);
+    put_field(" bytes in ", free_blocks);
+    put_field(" blocks, in use ", heap_size - free_bytes);
+    put_str(" bytes\n");
+}
+
+static void write_dump(void) {
+    int fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+
+    size_t off = 0;
+    while (off < dump_len) {
+        ssize_t n = write(fd, dump_buf + off, dump_len - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    close(fd);
+}
+
+static void dump_handler(int signo) {
+    (void)signo;
+    int saved_errno = errno;
+
+    if (__atomic_exchange_n(&dumping, 1, __ATOMIC_ACQUIRE)) {
+        errno = saved_errno;
+        return;
+    }
+
+    dump_len = 0;
+    dump_truncated = false;
+
+    put_field("pmalloc stats, pid ", getpid());
+    put_str("\n");
+    put_field("config: num_arenas ", pm_config.num_arenas);
+    put_field(", maxlists ", pm_config.maxlists);
+    put_field(", chunk_size ", pm_config.chunk_size);
+    put_field(", cache_max_entries ", pm_config.cache_max_entries);
+    put_field(", cache_max_size ", pm_config.cache_max_size);
+    put_str("\n");
+    put_field("signalled thread: allocated ", *pm_thread_allocatedp());
+    put_field(" bytes, freed ", *pm_thread_deallocatedp());
+    put_str(" bytes\n");
+
+    for (int i = 0; i < arena_count(); i++) {
+        dump_arena(i, arena_at(i));
+    }
+
+    if (dump_truncated) {
+        /* dump_reserve guarantees this fits. */
+        static const char notice[] = "(truncated)\n";
+        memcpy(dump_buf + dump_len, notice, sizeof(notice) - 1);
+        dump_len += sizeof(notice) - 1;
+    }
+    write_dump();
+
+    __atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+    errno = saved_errno;
+}
+
+bool pm_sigdump_install(int signo, const char *path) {
+    if (strlen(path) >= sizeof(dump_path))
+        return false;
+
+    if (!dump_buf) {
+        dump_buf = map_region(SIGDUMP_BUFFER_SIZE, "pmalloc:sigdump");
+        if (!dump_buf)
+            return false;
+    }
+
+    /* don't let the handler see a half-copied path. */
+    __atomic_store_n(&dumping, 1, __ATOMIC_SEQ_CST);
+    strcpy(dump_path, path);
+    __atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(signo, &sa, NULL) == 0;
+}
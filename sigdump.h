@@ -0,0 +1,26 @@
+/* allocator state dump on a signal, e.g. `kill -USR2 <pid>`. */
+
+#ifndef SIGDUMP_H_
+#define SIGDUMP_H_
+
+#include <stdbool.h>
+
+/* size of the buffer the report is formatted into. reports that
+ * don't fit are cut short, and say so.
+ */
+#define SIGDUMP_BUFFER_SIZE  (1 << 16)
+
+/* longest seglist walk per list, in case a list is being changed
+ * underneath the dump.
+ */
+#define SIGDUMP_MAX_WALK  (1 << 16)
+
+/* installs a handler for signo that writes allocator statistics and
+ * a per-arena seglist summary to path (truncating it) every time the
+ * signal arrives. the buffer is set up here, so the handler itself
+ * only makes async-signal-safe calls.
+ * returns false if the buffer or the handler couldn't be set up.
+ */
+bool pm_sigdump_install(int signo, const char *path);
+
+#endif
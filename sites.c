@@ -0,0 +1,170 @@
+/**
+ * @file sites.c
+ * @brief lifetime prediction by allocation call site
+ *
+ * Samples are rare, so all the bookkeeping sits behind one lock: the
+ * per-site counts, and the table of outstanding samples, which is
+ * small enough to search linearly. The only thing read on every
+ * allocation is site_long, which holds the key of each site predicted
+ * long-lived (or 0), and is read and written atomically.
+ *
+ * A sample that is never freed would never be decided, so every
+ * SITE_SWEEP_EVERY samples the table is swept for samples that have
+ * grown old enough to count as long-lived. Those are counted and
+ * dropped; when their blocks are freed, site_sample_free() finds
+ * nothing and returns.
+ */
+
+#include "sites.h"
+#include "malloc.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define SITE_SWEEP_EVERY  64
+
+typedef struct site {
+    uint32_t key;
+    uint32_t short_lived;
+    uint32_t long_lived;
+} site_t;
+
+typedef struct sample {
+    void *ptr;
+    uint32_t site;
+    uint64_t born;
+} sample_t;
+
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+static site_t sites[SITE_TABLE_SIZE];
+static sample_t samples[SITE_MAX_SAMPLES];
+static size_t num_samples;
+static size_t samples_since_sweep;
+
+static uint32_t site_long[SITE_TABLE_SIZE];
+
+static __thread uint32_t countdown;
+static __thread uint32_t countdown_seed;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint32_t site_key(void *caller, size_t size) {
+    uint64_t h = (uintptr_t)caller ^ ((uint64_t)size_to_class(size) << 56);
+    /* mix every bit into the low ones, which pick the table slot. */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    /* 0 marks an empty slot. */
+    return (uint32_t)h | 1;
+}
+
+bool site_predicts_long(uint32_t site) {
+    return __atomic_load_n(&site_long[site % SITE_TABLE_SIZE],
+                           __ATOMIC_RELAXED) == site;
+}
+
+bool site_sample_due(size_t interval) {
+    if (interval == 0)
+        return false;
+    if (countdown > 1) {
+        countdown--;
+        return false;
+    }
+
+    /* the gap to the next sample varies around the interval, so that
+     * allocation patterns with the same period don't always put the
+     * same site under the sample.
+     */
+    countdown_seed = countdown_seed * 1103515245 + 12345;
+    countdown = 1 + (countdown_seed >> 8) % (2 * interval);
+    return true;
+}
+
+/* adds one decided sample to its site's counts, and updates the
+ * site's prediction. called with site_lock held.
+ */
+static void count_sample(uint32_t key, bool long_lived) {
+    site_t *site = &sites[key % SITE_TABLE_SIZE];
+    if (site->key != key)
+        return;
+
+    if (long_lived)
+        site->long_lived++;
+    else
+        site->short_lived++;
+
+    uint32_t total = site->short_lived + site->long_lived;
+    if (total >= SITE_MAX_WEIGHT) {
+        site->short_lived /= 2;
+        site->long_lived /= 2;
+        total = site->short_lived + site->long_lived;
+    }
+
+    bool predict = total >= SITE_MIN_SAMPLES &&
+                   4 * site->long_lived >= 3 * total;
+    __atomic_store_n(&site_long[key % SITE_TABLE_SIZE], predict ? key : 0,
+                     __ATOMIC_RELAXED);
+}
+
+static void drop_sample(size_t i) {
+    samples[i] = samples[--num_samples];
+}
+
+/* counts and drops the samples that have lived long enough. called
+ * with site_lock held.
+ */
+static void sweep(uint64_t now) {
+    for (size_t i = 0; i < num_samples;) {
+        if (now - samples[i].born >= SITE_LONG_LIVED_NS) {
+            count_sample(samples[i].site, true);
+            drop_sample(i);
+        } else {
+            i++;
+        }
+    }
+    samples_since_sweep = 0;
+}
+
+bool site_sample_alloc(uint32_t key, void *ptr) {
+    uint64_t now = now_ns();
+    bool recorded = false;
+
+    pthread_mutex_lock(&site_lock);
+    if (++samples_since_sweep >= SITE_SWEEP_EVERY ||
+        num_samples == SITE_MAX_SAMPLES)
+        sweep(now);
+
+    if (num_samples < SITE_MAX_SAMPLES) {
+        site_t *site = &sites[key % SITE_TABLE_SIZE];
+        if (site->key != key) {
+            site->key = key;
+            site->short_lived = 0;
+            site->long_lived = 0;
+            __atomic_store_n(&site_long[key % SITE_TABLE_SIZE], 0,
+                             __ATOMIC_RELAXED);
+        }
+        samples[num_samples++] = (sample_t){ ptr, key, now };
+        recorded = true;
+    }
+    pthread_mutex_unlock(&site_lock);
+    return recorded;
+}
+
+void site_sample_free(void *ptr) {
+    uint64_t now = now_ns();
+
+    pthread_mutex_lock(&site_lock);
+    for (size_t i = 0; i < num_samples; i++) {
+        if (samples[i].ptr == ptr) {
+            count_sample(samples[i].site,
+                         now - samples[i].born >= SITE_LONG_LIVED_NS);
+            drop_sample(i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&site_lock);
+}
@@ -0,0 +1,70 @@
+/* lifetime prediction by allocation call site, for the cached
+ * allocator.
+ *
+ * one arena_cached_malloc() call in every lifetime_sample_interval (a
+ * tunable; 0, the default, turns all of this off) is sampled: its
+ * block gets sampled_mask set in its header, and its call site and
+ * birth time go into a small table. a sample freed within
+ * SITE_LONG_LIVED_NS counts as short-lived for its site, and one still
+ * allocated after that as long-lived. once most of a site's samples
+ * are long-lived, its later allocations go to the long-lived arena
+ * pool (see pm_lifetime_t in malloc.h), and stay out of the arenas
+ * that churn.
+ *
+ * a site is the return address of arena_cached_malloc() together with
+ * the size class of the request. walking further up the stack isn't
+ * safe without frame pointers, and the size class tells apart most of
+ * the allocations that a wrapper funnels through one return address.
+ */
+
+#ifndef SITES_H_
+#define SITES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of sites tracked at once. sites that hash to the same slot
+ * take it over from each other.
+ */
+#define SITE_TABLE_SIZE  1024
+
+/* number of samples that can be outstanding at once. while the table
+ * is full, nothing more is sampled.
+ */
+#define SITE_MAX_SAMPLES  1024
+
+/* age at which a sample counts as long-lived. */
+#define SITE_LONG_LIVED_NS  (50 * 1000 * 1000)
+
+/* a site needs this many decided samples before it is predicted, and
+ * three quarters of them long-lived to be predicted long-lived.
+ */
+#define SITE_MIN_SAMPLES  8
+
+/* once a site has this many decided samples, its counts are halved,
+ * so that the prediction follows a site whose behaviour changes.
+ */
+#define SITE_MAX_WEIGHT  256
+
+uint32_t site_key(void *caller, size_t size);
+
+/* true if allocations from site should go to the long-lived pool. */
+bool site_predicts_long(uint32_t site);
+
+/* counts down to the calling thread's next sample, one in about every
+ * interval allocations. the caller reads lifetime_sample_interval once
+ * and passes it in, since pm_ctl() may set it to 0 at any time; an
+ * interval of 0 never samples.
+ */
+bool site_sample_due(size_t interval);
+
+/* records a sampled allocation. returns false if there was no room
+ * for it, in which case the block must not be marked.
+ */
+bool site_sample_alloc(uint32_t site, void *ptr);
+
+/* records the end of a sampled block's life. */
+void site_sample_free(void *ptr);
+
+#endif
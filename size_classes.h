@@ -0,0 +1,64 @@
+/* generated by tools/gen_size_classes.py from size_classes.spec. do not edit. */
+
+#ifndef SIZE_CLASSES_H_
+#define SIZE_CLASSES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NUM_SIZE_CLASSES  15
+
+/* sizes up to this are classified by a direct table lookup. */
+#define SIZE_CLASS_LOOKUP_MAX  4096
+
+/* smallest block size in each class. */
+static const uint32_t class_to_size[NUM_SIZE_CLASSES] = {
+    32, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536, 131072, 262144, 524288,
+};
+
+/* how many blocks of each class move between an arena and a
+ * thread cache at once.
+ */
+static const uint8_t class_batch[NUM_SIZE_CLASSES] = {
+    32, 32, 16, 8, 8, 4, 4, 2, 1, 1, 1, 1, 1, 1, 1,
+};
+
+/* class of each size up to SIZE_CLASS_LOOKUP_MAX, indexed by size / 16. */
+static const uint8_t size_to_class_small[(SIZE_CLASS_LOOKUP_MAX / 16) + 1] = {
+    0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    7,
+};
+
+/* class of each larger size, indexed by its bit length. */
+static const uint8_t size_to_class_log[65] = {
+    0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+    10, 11, 12, 13, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14,
+};
+
+/* returns the size class of a block of the given size. */
+static inline size_t size_to_class(size_t size) {
+    if (size <= SIZE_CLASS_LOOKUP_MAX)
+        return size_to_class_small[size / 16];
+    return size_to_class_log[64 - __builtin_clzl(size)];
+}
+
+#endif
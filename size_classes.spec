@@ -0,0 +1,29 @@
+# seglist size classes, one per line, smallest first.
+#
+#   <smallest block size in the class> <batch>
+#
+# a block belongs to the last class whose smallest size it reaches.
+# batch is how many blocks of the class move between an arena and a
+# thread cache at once.
+#
+# sizes must be multiples of 16. sizes above the direct lookup limit
+# (see tools/gen_size_classes.py) must be powers of two.
+#
+# after editing, regenerate size_classes.h with
+#     tools/gen_size_classes.py size_classes.spec > size_classes.h
+
+32      32
+64      32
+128     16
+256     8
+512     8
+1024    4
+2048    4
+4096    2
+8192    1
+16384   1
+32768   1
+65536   1
+131072  1
+262144  1
+524288  1
@@ -0,0 +1,170 @@
+/**
+ * @file tags.c
+ * @brief allocation tags and their per-thread byte counts
+ *
+ * Every thread that counts anything links its counters into a list
+ * under tag_lock, and pm_tag_stats() sums that list. A thread only
+ * ever adds to its own counters, so it updates them with plain
+ * relaxed stores, and readers see each counter either before or after
+ * an update, never torn. When a thread exits, its counts move to the
+ * retired totals and its counters leave the list.
+ */
+
+#include "tags.h"
+#include "malloc.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+typedef struct tag_counts {
+    uint64_t allocated[PM_MAX_TAGS];
+    uint64_t freed[PM_MAX_TAGS];
+    struct tag_counts *prev;
+    struct tag_counts *next;
+} tag_counts_t;
+
+__thread pm_tag_t pm_thread_tag;
+
+static pthread_mutex_t tag_lock = PTHREAD_MUTEX_INITIALIZER;
+static char tag_names[PM_MAX_TAGS][PM_TAG_NAME_MAX];
+static pm_tag_t num_tags = 1;
+
+/* the counters of every live thread that has counted something, and
+ * what threads that have exited left behind.
+ */
+static tag_counts_t *tag_threads;
+static uint64_t retired_allocated[PM_MAX_TAGS];
+static uint64_t retired_freed[PM_MAX_TAGS];
+
+static __thread tag_counts_t thread_counts;
+static __thread bool thread_linked;
+static __thread bool thread_exited;
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static void thread_exit(void *arg) {
+    tag_counts_t *counts = arg;
+
+    pthread_mutex_lock(&tag_lock);
+    for (int i = 0; i < PM_MAX_TAGS; i++) {
+        retired_allocated[i] += counts->allocated[i];
+        retired_freed[i] += counts->freed[i];
+    }
+    if (counts->prev)
+        counts->prev->next = counts->next;
+    else
+        tag_threads = counts->next;
+    if (counts->next)
+        counts->next->prev = counts->prev;
+    pthread_mutex_unlock(&tag_lock);
+
+    thread_exited = true;
+}
+
+static void make_exit_key(void) {
+    pthread_key_create(&exit_key, thread_exit);
+}
+
+static void link_thread(void) {
+    pthread_once(&exit_key_once, make_exit_key);
+
+    pthread_mutex_lock(&tag_lock);
+    thread_counts.prev = NULL;
+    thread_counts.next = tag_threads;
+    if (tag_threads)
+        tag_threads->prev = &thread_counts;
+    tag_threads = &thread_counts;
+    pthread_mutex_unlock(&tag_lock);
+
+    pthread_setspecific(exit_key, &thread_counts);
+    thread_linked = true;
+}
+
+/* adds size to one of the calling thread's counters. blocks freed by
+ * destructors that run after thread_exit() go straight to the
+ * retired totals.
+ */
+static void add_count(uint64_t *counters, uint64_t *retired, pm_tag_t tag,
+                      size_t size) {
+    assert(tag < PM_MAX_TAGS);
+    if (thread_exited) {
+        pthread_mutex_lock(&tag_lock);
+        retired[tag] += size;
+        pthread_mutex_unlock(&tag_lock);
+        return;
+    }
+    if (!thread_linked)
+        link_thread();
+    __atomic_store_n(&counters[tag], counters[tag] + size, __ATOMIC_RELAXED);
+}
+
+void tag_count_alloc(pm_tag_t tag, size_t size) {
+    add_count(thread_counts.allocated, retired_allocated, tag, size);
+}
+
+void tag_count_free(pm_tag_t tag, size_t size) {
+    add_count(thread_counts.freed, retired_freed, tag, size);
+}
+
+pm_tag_t pm_tag_register(const char *name) {
+    pm_tag_t tag = PM_TAG_NONE;
+
+    pthread_mutex_lock(&tag_lock);
+    if (num_tags < PM_MAX_TAGS) {
+        tag = num_tags++;
+        strncpy(tag_names[tag], name, PM_TAG_NAME_MAX - 1);
+    }
+    pthread_mutex_unlock(&tag_lock);
+    return tag;
+}
+
+const char *pm_tag_name(pm_tag_t tag) {
+    if (tag == PM_TAG_NONE || tag >= PM_MAX_TAGS)
+        return NULL;
+    return tag_names[tag];
+}
+
+pm_tag_t pm_tag_set(pm_tag_t tag) {
+    assert(tag < PM_MAX_TAGS);
+    pm_tag_t old = pm_thread_tag;
+    pm_thread_tag = tag;
+    return old;
+}
+
+void pm_tag_restore(pm_tag_t *saved) {
+    pm_thread_tag = *saved;
+}
+
+bool pm_tag_stats(pm_tag_t tag, pm_tag_stats_t *stats) {
+    if (tag == PM_TAG_NONE || tag >= PM_MAX_TAGS)
+        return false;
+
+    pthread_mutex_lock(&tag_lock);
+    stats->allocated = retired_allocated[tag];
+    stats->freed = retired_freed[tag];
+    for (tag_counts_t *counts = tag_threads; counts; counts = counts->next) {
+        stats->allocated += __atomic_load_n(&counts->allocated[tag],
+                                            __ATOMIC_RELAXED);
+        stats->freed += __atomic_load_n(&counts->freed[tag], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&tag_lock);
+    return true;
+}
+
+void pm_tag_print(FILE *out) {
+    pthread_mutex_lock(&tag_lock);
+    pm_tag_t tags = num_tags;
+    pthread_mutex_unlock(&tag_lock);
+
+    for (pm_tag_t tag = 1; tag < tags; tag++) {
+        pm_tag_stats_t stats;
+        pm_tag_stats(tag, &stats);
+        /* the threads' counts aren't read all at once, so a free can
+         * show up before its allocation.
+         */
+        fprintf(out, "%-*s %12lld bytes live\n", PM_TAG_NAME_MAX,
+                tag_names[tag], (long long)(stats.allocated - stats.freed));
+    }
+}
@@ -0,0 +1,89 @@
+/* allocation tags, for per-subsystem memory accounting.
+ *
+ * each thread has a current tag. the cached allocator records it in
+ * the header of every block it hands out through arena_cached_malloc()
+ * or pm_mallocx(), and counts the block's bytes as allocated under it.
+ * when the block is freed, by whichever thread, its bytes are counted
+ * as freed under the same tag. the counts are kept per thread, and
+ * only summed up when someone asks for them, so tagging costs an
+ * allocation no locks and no shared writes.
+ *
+ *     static pm_tag_t parser_tag;
+ *     parser_tag = pm_tag_register("parser");
+ *     ...
+ *     {
+ *         PM_TAG_SCOPE(parser_tag);
+ *         parse(input);    // everything allocated here is "parser"'s
+ *     }
+ *
+ * blocks allocated while no tag is set (PM_TAG_NONE) aren't counted.
+ */
+
+#ifndef TAGS_H_
+#define TAGS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned pm_tag_t;
+
+#define PM_TAG_NONE  0
+
+/* tags a process can register, PM_TAG_NONE included. they have to fit
+ * in the top byte of a block header.
+ */
+#define PM_MAX_TAGS  64
+
+#define PM_TAG_NAME_MAX  32
+
+/* the calling thread's current tag. */
+extern __thread pm_tag_t pm_thread_tag;
+
+/* registers a tag. names longer than PM_TAG_NAME_MAX - 1 bytes are
+ * cut short. returns PM_TAG_NONE once PM_MAX_TAGS - 1 tags exist.
+ */
+pm_tag_t pm_tag_register(const char *name);
+
+const char *pm_tag_name(pm_tag_t tag);
+
+/* makes tag the calling thread's current tag, and returns the one it
+ * replaces.
+ */
+pm_tag_t pm_tag_set(pm_tag_t tag);
+
+/* for PM_TAG_SCOPE(). */
+void pm_tag_restore(pm_tag_t *saved);
+
+/* sets the current tag until the end of the enclosing block. */
+#define PM_TAG_SCOPE(tag) \
+    pm_tag_t pm_tag_saved_ __attribute__((cleanup(pm_tag_restore))) = \
+        pm_tag_set(tag)
+
+/* bytes allocated and freed under a tag by every thread, past and
+ * present. sizes are block sizes, so they include per-block overhead.
+ */
+typedef struct pm_tag_stats {
+    uint64_t allocated;
+    uint64_t freed;
+} pm_tag_stats_t;
+
+bool pm_tag_stats(pm_tag_t tag, pm_tag_stats_t *stats);
+
+/* writes one line per registered tag: its name and its live bytes. */
+void pm_tag_print(FILE *out);
+
+/* for the allocator: counts a tagged block's bytes. */
+void tag_count_alloc(pm_tag_t tag, size_t size);
+void tag_count_free(pm_tag_t tag, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,8 @@
 #include <pthread.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #if defined (TEST_ARENA_ONLY)
     #define test_malloc arena_malloc
@@ -14,6 +16,7 @@
     #define test_malloc arena_cached_malloc
     #define test_free arena_cached_free
     #define test_init arena_cached_malloc_init
+    #define TEST_LIFETIMES
 
 #elif defined (TEST_NAIVE)
     #define test_malloc naive_malloc
@@ -81,11 +84,103 @@ void *malloc_simple(void *arg) {
     size_t num_mallocs = (size_t) arg;
    for (int i = 0; i < num_mallocs; i++) {
        void *ptr = test_malloc(1 << (rand() % MAX_MALLOC_LG));
-       if (ptr) free(ptr);
+       if (ptr) test_free(ptr);
    }
    return NULL;
 }
 
+/* long-lived blocks mixed in with short-lived ones. each round
+ * allocates a batch of short-lived blocks, one in LONG_LIVED_EVERY of
+ * them followed by a long-lived one, and then frees the short-lived
+ * blocks. the long-lived ones are never freed, so whatever they pin
+ * down shows up in the fragmentation report at the end.
+ */
+#define LIFETIME_ROUND  64
+#define LONG_LIVED_EVERY  8
+
+#ifdef TEST_LIFETIMES
+static bool hint_lifetimes = false;
+#endif
+
+/* short- and long-lived blocks are allocated from different call
+ * sites, which is what lifetime prediction (lifetime_sample_interval)
+ * tells them apart by.
+ */
+static void *short_lived_malloc(size_t size) {
+#ifdef TEST_LIFETIMES
+    if (hint_lifetimes)
+        return pm_mallocx(size, PM_MALLOCX_LIFETIME(PM_LIFETIME_SHORT));
+#endif
+    return test_malloc(size);
+}
+
+static void *long_lived_malloc(size_t size) {
+#ifdef TEST_LIFETIMES
+    if (hint_lifetimes)
+        return pm_mallocx(size, PM_MALLOCX_LIFETIME(PM_LIFETIME_LONG));
+#endif
+    return test_malloc(size);
+}
+
+void *malloc_lifetime(void *arg) {
+#ifdef TEST_ARENA_CACHE
+    init_tcache();
+#endif
+    size_t num_mallocs = (size_t) arg;
+    void *round[LIFETIME_ROUND];
+
+    for (size_t i = 0; i < num_mallocs; i += LIFETIME_ROUND) {
+        for (int j = 0; j < LIFETIME_ROUND; j++) {
+            round[j] = short_lived_malloc(1 << (rand() % MAX_MALLOC_LG));
+            if (j % LONG_LIVED_EVERY == 0)
+                long_lived_malloc(64 + rand() % 192);
+        }
+        for (int j = 0; j < LIFETIME_ROUND; j++) {
+            if (round[j])
+                test_free(round[j]);
+        }
+    }
+    return NULL;
+}
+
+/* sums up the free blocks of every arena. a heap whose free bytes are
+ * mostly in blocks far smaller than its largest one has been carved up
+ * by blocks that stayed allocated.
+ */
+static void report_fragmentation(void) {
+    size_t heap = 0, free_bytes = 0, largest = 0, small = 0;
+
+    /* the naive allocator doesn't use the arena table. */
+    if (arena_count() == 0)
+        return;
+
+    for (int i = 0; i < arena_count(); i++) {
+        arena_t *arena = arena_at(i);
+        if (!arena->heap_start)
+            continue;
+        heap += (char *)arena->heap_end - (char *)arena->heap_start;
+
+        /* the walk stops at the epilogue, which has size 0. */
+        block_t *block = arena->heap_start;
+        for (; get_size(block) != 0;
+             block = (block_t *)((char *)block + get_size(block))) {
+            if (block->header & alloc_mask)
+                continue;
+            size_t size = get_size(block);
+            free_bytes += size;
+            if (size > largest)
+                largest = size;
+            if (size < CHUNK_SIZE)
+                small += size;
+        }
+    }
+
+    printf("heap %zu KB, free %zu KB, largest free block %zu KB, "
+           "%.1f%% of free bytes in blocks under %d KB\n",
+           heap >> 10, free_bytes >> 10, largest >> 10,
+           free_bytes ? 100.0 * small / free_bytes : 0.0, CHUNK_SIZE >> 10);
+}
+
 #if 0 
 
 void *malloc_only_thread(a4t *args) {
@@ -99,10 +194,10 @@ void free_only_thread(addr) {
 }
 #endif
 
-void many_mallocs(size_t num_mallocs) {
+void many_mallocs(size_t num_mallocs, void *(*test_thread)(void *)) {
     pthread_t thread_ids[NUM_THREADS];
     for (int i = 0; i < NUM_THREADS; ++i) {
-        pthread_create(&(thread_ids[i]), NULL, &malloc_test_thread, (void *)num_mallocs);
+        pthread_create(&(thread_ids[i]), NULL, test_thread, (void *)num_mallocs);
     }
 
     for (int j = 0; j < NUM_THREADS; ++j) {
@@ -146,13 +241,47 @@ void malloc_and_free(int num_mallocs, int max_size) {
 }
 #endif
 
+/* usage: ./a.out [workload] [mallocs per thread]
+ * workloads:
+ *   mixed     random sizes, frees ~10% of the time (default)
+ *   simple    every allocation is freed right away
+ *   lifetime  short-lived blocks with long-lived ones mixed in, then
+ *             a fragmentation report
+ *   lifetime-hinted
+ *             the same, with each block's lifetime passed to
+ *             pm_mallocx() (TEST_ARENA_CACHE builds only). the
+ *             lifetime pools are only set aside when run with
+ *             PMALLOC_CONF=lifetime_arenas:1 or more
+ */
 int main(int argc, const char* argv[]) {
+    const char *workload = argc > 1 ? argv[1] : "mixed";
+    size_t num_mallocs = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+
+    void *(*test_thread)(void *);
+    if (strcmp(workload, "mixed") == 0) {
+        test_thread = malloc_test_thread;
+    } else if (strcmp(workload, "simple") == 0) {
+        test_thread = malloc_simple;
+    } else if (strcmp(workload, "lifetime") == 0) {
+        test_thread = malloc_lifetime;
+#ifdef TEST_LIFETIMES
+    } else if (strcmp(workload, "lifetime-hinted") == 0) {
+        test_thread = malloc_lifetime;
+        hint_lifetimes = true;
+#endif
+    } else {
+        fprintf(stderr, "unknown workload '%s'\n", workload);
+        return 1;
+    }
+
     test_init();
     srand(time(0));
 
     clock_t start = clock();
 
-    many_mallocs(100000);
+    many_mallocs(num_mallocs, test_thread);
     printf("Time taken for malloc test: %.7f\n", (double) (clock() - start) / CLOCKS_PER_SEC);
+    if (test_thread == malloc_lifetime)
+        report_fragmentation();
     return 0;
 }
\ No newline at end of file
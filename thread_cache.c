@@ -16,8 +16,10 @@
 
 #include "thread_cache.h"
 #include "malloc.h"
+#include "config.h"
 
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 
 void cache_init(cache_t *c) {
@@ -29,22 +31,36 @@ void cache_init(cache_t *c) {
     /* this is used to indicate that there is nothing
      * currently in the cache.
      */
-    c->front = CACHE_MAX_ENTRIES;
+    c->front = CACHE_CAPACITY;
+    c->end = 0;
+}
+
+/* restores front and end after an entry has been removed. */
+static void cache_trim(cache_t *c) {
+    while (c->end > 0 && !c->elems[c->end - 1])
+        c->end--;
+    while (c->front < c->end && !c->elems[c->front])
+        c->front++;
+    if (c->front >= c->end)
+        c->front = CACHE_CAPACITY;
 }
 
 bool cache_add(cache_t *c, block_t *block) {    
-    if (c->num_entries == CACHE_MAX_ENTRIES)
+    size_t max_entries = pm_config.cache_max_entries;
+    if (c->num_entries >= max_entries)
         return false;
     
     size_t bsize = get_size(block);
-    if (c->total_size + bsize > CACHE_MAX_SIZE)
+    if (c->total_size + bsize > pm_config.cache_max_size)
         return false;
     
     /* max cache entries is really small (currently 8), 
      * so can afford to do this without impacting performance
-     * at all.
+     * at all. if the limit was lowered at runtime, slots past
+     * it may still be occupied, but there is always a free
+     * slot below it.
      */
-    for (int i = 0; i < CACHE_MAX_ENTRIES; i++) {
+    for (int i = 0; i < (int)max_entries; i++) {
         if (!c->elems[i]) {
             c->num_entries++;
             c->total_size += bsize;
@@ -52,6 +68,9 @@ bool cache_add(cache_t *c, block_t *block) {
             if (i < c->front) {
                 c->front = i;
             }
+            if (i >= c->end) {
+                c->end = i + 1;
+            }
             break;
         }
     }
@@ -66,26 +85,24 @@ block_t *cache_evict(cache_t *c) {
 
     block_t *result = c->elems[c->front];
     c->elems[c->front] = NULL;
-    while (c->front < CACHE_MAX_ENTRIES && !c->elems[c->front])
-        c->front++;
+    cache_trim(c);
     
     return result;
 }
 
 block_t *cache_query(cache_t *c, size_t size) {
-    for (int i = c->front; i < CACHE_MAX_ENTRIES; i++) {
+    for (int i = c->front; i < c->end; i++) {
         if (!c->elems[i]) continue;
 
         block_t *b = c->elems[i];
         size_t bsize = get_size(b);
-        if (bsize >= size) {            
+        /* the header takes a word of the block. */
+        if (bsize >= size + wsize) {
             c->elems[i] = NULL;
             c->total_size -= bsize;
             c->num_entries--;
-            if (i == c->front) {
-                while (c->front < CACHE_MAX_ENTRIES && !c->elems[c->front]) {
-                    c->front++;
-                }
+            if (i == c->front || i == c->end - 1) {
+                cache_trim(c);
             }
 
             return b;
@@ -93,4 +110,47 @@ block_t *cache_query(cache_t *c, size_t size) {
     }
 
     return NULL;
+}
+
+/* consistency check, used by the heap checker. cached blocks stay
+ * marked as allocated in their arena, so each entry must be allocated,
+ * and must not appear in the cache more than once.
+ */
+bool cache_check(cache_t *c) {
+    size_t entries = 0;
+    size_t total_size = 0;
+    int front = CACHE_CAPACITY;
+    int end = 0;
+
+    for (int i = 0; i < CACHE_CAPACITY; i++) {
+        block_t *b = c->elems[i];
+        if (!b) continue;
+
+        if (i < front)
+            front = i;
+        end = i + 1;
+        entries++;
+        total_size += get_size(b);
+
+        if (!(b->header & alloc_mask)) {
+            fprintf(stderr, "cache_check: free block %p in cache\n", (void *)b);
+            return false;
+        }
+        for (int j = i + 1; j < CACHE_CAPACITY; j++) {
+            if (c->elems[j] == b) {
+                fprintf(stderr, "cache_check: block %p cached twice\n", (void *)b);
+                return false;
+            }
+        }
+    }
+
+    if (entries != c->num_entries || total_size != c->total_size) {
+        fprintf(stderr, "cache_check: entry count or size is wrong\n");
+        return false;
+    }
+    if (c->front != front || c->end != end) {
+        fprintf(stderr, "cache_check: front or end is misplaced\n");
+        return false;
+    }
+    return true;
 }
\ No newline at end of file
@@ -13,6 +13,11 @@
  */
 #define CACHE_MAX_ENTRIES 8
 
+/* number of slots in a cache. the "cache_max_entries" tunable
+ * can be raised at runtime up to this.
+ */
+#define CACHE_CAPACITY 32
+
 /* maximum amount of memory that can be kept in a single cache entry.
  * at the moment, we are limiting total cache size to 1 MB.
  */
@@ -27,10 +32,16 @@
  */
 #define CACHE_EVICT_PROBABILITY (0.1f)
 
+/* what cache_max_entries and cache_max_size are lowered to while the
+ * allocator is under memory pressure (see pressure.h).
+ */
+#define PRESSURE_CACHE_MAX_ENTRIES 1
+#define PRESSURE_CACHE_MAX_SIZE (64 * 1024)
+
 typedef struct block block_t;
 
 typedef struct cache { 
-    block_t *elems[CACHE_MAX_ENTRIES];
+    block_t *elems[CACHE_CAPACITY];
 
     /* number of entries in the cache. */
     size_t num_entries;
@@ -40,12 +51,16 @@ typedef struct cache {
 
     /* front-most entry. */
     int front;
+
+    /* one past the back-most entry. */
+    int end;
 } cache_t;
 
 bool cache_full(cache_t *c);
 bool cache_add(cache_t *c, block_t *block);
 block_t *cache_evict(cache_t *c);
 void cache_init(cache_t *c);
+bool cache_check(cache_t *c);
 
 block_t *cache_query(cache_t *c, size_t size);
 
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""Searches allocator settings for the best throughput / memory trade-off.
+
+The stress test in tests.c is built once (with the cached allocator), and
+then run under many settings of the tunables through PMALLOC_CONF (see
+config.h). Every setting is run --repeat times on the chosen workload;
+its throughput is the median over the runs, and its memory is the
+largest peak RSS. At the end, the settings on the Pareto front of
+throughput against peak RSS are listed, each with the PMALLOC_CONF
+string that reproduces it.
+
+The search samples --trials random points from SPACE, plus the defaults
+as a baseline. Seglist count and cache entries can only go up to
+NUM_SIZE_CLASSES and CACHE_CAPACITY; raising those needs a rebuild.
+
+usage: autotune.py [--workload mixed|simple] [--mallocs N] [--threads N]
+                   [--trials N] [--repeat N] [--csv out.csv]
+"""
+
+import argparse
+import os
+import random
+import statistics
+import subprocess
+import sys
+import time
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SPACE = {
+    "maxlists": [4, 8, 12, 15],
+    "max_seglist_search": [1, 4, 15, 64],
+    "chunk_size": [4096, 16384, 65536, 262144],
+    "cache_max_entries": [0, 4, 8, 16, 32],
+    "cache_max_size": [64 << 10, 256 << 10, 1 << 20, 4 << 20],
+    "cache_evict_probability": [0.0, 0.1, 0.5, 1.0],
+    "num_arenas": [1, 2, 4, 8, 10, 16, 32],
+}
+
+
+def build(threads, out, cflags):
+    sources = sorted(f for f in os.listdir(REPO) if f.endswith(".c"))
+    cmd = (["gcc", "-pthread", "-D", "TEST_ARENA_CACHE",
+            "-D", "NUM_THREADS=%d" % threads] + cflags.split() +
+           sources + ["-o", out])
+    subprocess.run(cmd, cwd=REPO, check=True)
+
+
+def conf_string(conf):
+    return ",".join("%s:%s" % (k, v) for k, v in sorted(conf.items()))
+
+
+def run_once(binary, workload, mallocs, conf, timeout):
+    """Returns (wall seconds, peak RSS in bytes), or None on failure."""
+    env = dict(os.environ)
+    if conf:
+        env["PMALLOC_CONF"] = conf_string(conf)
+
+    start = time.monotonic()
+    proc = subprocess.Popen([binary, workload, str(mallocs)], env=env,
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    # wait4() rather than proc.wait(), to get this child's own rusage.
+    while True:
+        pid, status, usage = os.wait4(proc.pid, os.WNOHANG)
+        if pid != 0:
+            break
+        if time.monotonic() - start > timeout:
+            proc.kill()
+            os.wait4(proc.pid, 0)
+            return None
+        time.sleep(0.005)
+    wall = time.monotonic() - start
+
+    if status != 0:
+        return None
+    # ru_maxrss is in KB on Linux.
+    return wall, usage.ru_maxrss * 1024
+
+
+def evaluate(binary, args, conf):
+    walls, rss = [], []
+    for _ in range(args.repeat):
+        result = run_once(binary, args.workload, args.mallocs, conf, args.timeout)
+        if result is None:
+            return None
+        walls.append(result[0])
+        rss.append(result[1])
+    ops = args.mallocs * args.threads
+    return ops / statistics.median(walls), max(rss)
+
+
+def pareto_front(results):
+    """Indices of results no other result beats on both axes."""
+    front = []
+    for i, (_, (tput, rss)) in enumerate(results):
+        dominated = any(
+            t >= tput and r <= rss and (t > tput or r < rss)
+            for j, (_, (t, r)) in enumerate(results) if j != i)
+        if not dominated:
+            front.append(i)
+    return front
+
+
+def human(n):
+    for unit in ("B", "KB", "MB", "GB"):
+        if n < 1024:
+            return "%d %s" % (n, unit)
+        n //= 1024
+    return "%d TB" % n
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--workload", default="mixed", choices=["mixed", "simple"])
+    parser.add_argument("--mallocs", type=int, default=100000,
+                        help="allocations per thread")
+    parser.add_argument("--threads", type=int, default=os.cpu_count() or 4)
+    parser.add_argument("--trials", type=int, default=40,
+                        help="number of random settings to try")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--timeout", type=float, default=300)
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--cflags", default="-O2", help="flags for the build")
+    parser.add_argument("--csv", help="also write every result to this file")
+    args = parser.parse_args()
+
+    binary = os.path.join(REPO, "_autotune_bench")
+    build(args.threads, binary, args.cflags)
+
+    rng = random.Random(args.seed)
+    configs = [{}]
+    seen = set()
+    for _ in range(args.trials):
+        conf = {k: rng.choice(v) for k, v in SPACE.items()}
+        key = conf_string(conf)
+        if key not in seen:
+            seen.add(key)
+            configs.append(conf)
+
+    results = []
+    for n, conf in enumerate(configs):
+        label = conf_string(conf) or "(defaults)"
+        result = evaluate(binary, args, conf)
+        if result is None:
+            print("[%d/%d] %s: failed" % (n + 1, len(configs), label), file=sys.stderr)
+            continue
+        print("[%d/%d] %s: %.0f ops/s, peak RSS %s" %
+              (n + 1, len(configs), label, result[0], human(result[1])),
+              file=sys.stderr)
+        results.append((conf, result))
+
+    os.unlink(binary)
+    if not results:
+        sys.exit("every configuration failed")
+
+    if args.csv:
+        with open(args.csv, "w") as f:
+            f.write(",".join(["throughput", "peak_rss"] + list(SPACE)) + "\n")
+            for conf, (tput, rss) in results:
+                f.write(",".join([str(tput), str(rss)] +
+                                 [str(conf.get(k, "")) for k in SPACE]) + "\n")
+
+    front = pareto_front(results)
+    base_tput, base_rss = results[0][1] if not results[0][0] else (None, None)
+    print("Pareto front (%s workload, %d threads), fastest first:" %
+          (args.workload, args.threads))
+    for i in sorted(front, key=lambda i: -results[i][1][0]):
+        conf, (tput, rss) = results[i]
+        rel = ""
+        if base_tput:
+            rel = "  (%+.0f%% throughput, %+.0f%% RSS vs defaults)" % (
+                100.0 * (tput / base_tput - 1), 100.0 * (rss / base_rss - 1))
+        print("  %12.0f ops/s  %10s%s" % (tput, human(rss), rel))
+        print("      PMALLOC_CONF=\"%s\"" % (conf_string(conf) or ""))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Generates size_classes.h from size_classes.spec.
+
+The generated header has:
+  - class_to_size[]: the smallest block size in each class
+  - class_batch[]: per-class batch counts
+  - size_to_class_small[]: class of every block size up to
+    SIZE_CLASS_LOOKUP_MAX, indexed by size / 16
+  - size_to_class_log[]: class of larger sizes, indexed by bit length
+  - size_to_class(): one table load for sizes up to SIZE_CLASS_LOOKUP_MAX,
+    a count-leading-zeros and one table load above it
+
+usage: gen_size_classes.py size_classes.spec > size_classes.h
+"""
+
+import sys
+
+ALIGN = 16
+LOOKUP_MAX = 4096
+
+
+def parse(path):
+    classes = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            try:
+                size, batch = (int(x) for x in line.split())
+            except ValueError:
+                sys.exit("%s:%d: expected '<size> <batch>'" % (path, n))
+            if size % ALIGN != 0:
+                sys.exit("%s:%d: %d is not a multiple of %d" % (path, n, size, ALIGN))
+            if size > LOOKUP_MAX and size & (size - 1):
+                sys.exit("%s:%d: %d is above %d and not a power of two" %
+                         (path, n, size, LOOKUP_MAX))
+            if classes and size <= classes[-1][0]:
+                sys.exit("%s:%d: sizes must increase" % (path, n))
+            if not 1 <= batch <= 255:
+                sys.exit("%s:%d: batch must be between 1 and 255" % (path, n))
+            classes.append((size, batch))
+    if not classes:
+        sys.exit("%s: no size classes" % path)
+    if len(classes) > 255:
+        sys.exit("%s: too many size classes" % path)
+    return classes
+
+
+def class_of(classes, size):
+    c = 0
+    for i, (lo, _) in enumerate(classes):
+        if size >= lo:
+            c = i
+    return c
+
+
+def rows(values, per_row=16):
+    out = []
+    for i in range(0, len(values), per_row):
+        out.append("    " + ", ".join(str(v) for v in values[i:i + per_row]) + ",")
+    return "\n".join(out)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__.strip().splitlines()[-1])
+    spec = sys.argv[1]
+    classes = parse(spec)
+
+    small = [class_of(classes, i * ALIGN) for i in range(LOOKUP_MAX // ALIGN + 1)]
+    # sizes of bit length b are in [2^(b-1), 2^b). classes above the
+    # lookup limit start at powers of two, so one class covers all of them.
+    log = [class_of(classes, 1 << (b - 1)) if b > 0 else 0 for b in range(65)]
+
+    print("""/* generated by tools/gen_size_classes.py from %s. do not edit. */
+
+#ifndef SIZE_CLASSES_H_
+#define SIZE_CLASSES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NUM_SIZE_CLASSES  %d
+
+/* sizes up to this are classified by a direct table lookup. */
+#define SIZE_CLASS_LOOKUP_MAX  %d
+
+/* smallest block size in each class. */
+static const uint32_t class_to_size[NUM_SIZE_CLASSES] = {
+%s
+};
+
+/* how many blocks of each class move between an arena and a
+ * thread cache at once.
+ */
+static const uint8_t class_batch[NUM_SIZE_CLASSES] = {
+%s
+};
+
+/* class of each size up to SIZE_CLASS_LOOKUP_MAX, indexed by size / %d. */
+static const uint8_t size_to_class_small[(SIZE_CLASS_LOOKUP_MAX / %d) + 1] = {
+%s
+};
+
+/* class of each larger size, indexed by its bit length. */
+static const uint8_t size_to_class_log[65] = {
+%s
+};
+
+/* returns the size class of a block of the given size. */
+static inline size_t size_to_class(size_t size) {
+    if (size <= SIZE_CLASS_LOOKUP_MAX)
+        return size_to_class_small[size / %d];
+    return size_to_class_log[64 - __builtin_clzl(size)];
+}
+
+#endif""" % (spec, len(classes), LOOKUP_MAX,
+             rows([s for s, _ in classes], 8), rows([b for _, b in classes]),
+             ALIGN, ALIGN, rows(small), rows(log), ALIGN))
+
+
+if __name__ == "__main__":
+    main()
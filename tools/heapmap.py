@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""Analyzes heap maps written by heap_map_dump() (see heap_map.h).
+
+For every arena this prints how much of the heap is allocated and free,
+the largest free extent, a fragmentation score and a histogram of free
+extent sizes, followed by a heatmap of where in the heap the free memory
+sits. If matplotlib is installed, --png also renders the heatmap and the
+histograms to an image.
+
+usage: heapmap.py [--width N] [--png out.png] map.bin
+"""
+
+import argparse
+import struct
+import sys
+
+HEADER = struct.Struct("=4sIII")
+ARENA = struct.Struct("=QQII")
+BLOCK = struct.Struct("=II")
+
+# darker means more of that part of the heap is free.
+SHADES = " .:-=+*#%@"
+
+
+class Arena:
+    def __init__(self, index, heap_start, heap_end, blocks):
+        self.index = index
+        self.heap_start = heap_start
+        self.heap_end = heap_end
+        # list of (offset, size, allocated)
+        self.blocks = blocks
+
+    @property
+    def heap_size(self):
+        return self.heap_end - self.heap_start
+
+    def free_extents(self):
+        return [size for _, size, alloc in self.blocks if not alloc]
+
+    def free_fraction(self, width):
+        """Fraction of free bytes in each of `width` equal slices of the heap."""
+        span = max(self.heap_size, 1)
+        bounds = [i * span // width for i in range(width + 1)]
+        slices = [0.0] * width
+        for offset, size, alloc in self.blocks:
+            if alloc:
+                continue
+            start, end = offset, offset + size
+            first = max(start * width // span - 1, 0)
+            last = min((end * width) // span + 1, width - 1)
+            for i in range(first, last + 1):
+                lo, hi = bounds[i], bounds[i + 1]
+                slices[i] += max(0, min(end, hi) - max(start, lo))
+        return [min(1.0, slices[i] / max(bounds[i + 1] - bounds[i], 1))
+                for i in range(width)]
+
+
+def read_map(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, num_arenas, _ = HEADER.unpack_from(data, 0)
+    if magic != b"PMHM":
+        sys.exit("%s: not a heap map" % path)
+    if version != 1:
+        sys.exit("%s: unsupported heap map version %d" % (path, version))
+
+    pos = HEADER.size
+    arenas = []
+    for _ in range(num_arenas):
+        heap_start, heap_end, index, num_blocks = ARENA.unpack_from(data, pos)
+        pos += ARENA.size
+        blocks = []
+        for offset, size_alloc in BLOCK.iter_unpack(
+                data[pos:pos + num_blocks * BLOCK.size]):
+            blocks.append((offset, size_alloc & ~0xF, bool(size_alloc & 1)))
+        pos += num_blocks * BLOCK.size
+        arenas.append(Arena(index, heap_start, heap_end, blocks))
+    return arenas
+
+
+def log2_histogram(sizes):
+    hist = {}
+    for size in sizes:
+        bucket = max(size, 1).bit_length() - 1
+        hist[bucket] = hist.get(bucket, 0) + 1
+    return hist
+
+
+def human(n):
+    for unit in ("B", "KB", "MB", "GB"):
+        if n < 1024:
+            return "%d %s" % (n, unit)
+        n //= 1024
+    return "%d TB" % n
+
+
+def report(arena, width):
+    free = arena.free_extents()
+    free_bytes = sum(free)
+    largest = max(free, default=0)
+    alloc_bytes = sum(size for _, size, alloc in arena.blocks if alloc)
+
+    print("arena %d: heap %s, %d blocks" %
+          (arena.index, human(arena.heap_size), len(arena.blocks)))
+    print("  allocated   %s" % human(alloc_bytes))
+    print("  free        %s in %d extents, largest %s" %
+          (human(free_bytes), len(free), human(largest)))
+    if free_bytes:
+        # 0 when all free memory is one extent, close to 1 when it is
+        # scattered over many small ones.
+        print("  fragmentation %.3f" % (1.0 - largest / free_bytes))
+
+    hist = log2_histogram(free)
+    if hist:
+        print("  free extents by size:")
+        top = max(hist.values())
+        for bucket in sorted(hist):
+            bar = "#" * max(1, hist[bucket] * 40 // top)
+            print("    %10s+ %7d %s" % (human(1 << bucket), hist[bucket], bar))
+
+    shades = "".join(SHADES[int(f * (len(SHADES) - 1))]
+                     for f in arena.free_fraction(width))
+    print("  free heatmap: |%s|" % shades)
+    print()
+
+
+def render_png(arenas, width, path):
+    import matplotlib
+    matplotlib.use("Agg")
+    import matplotlib.pyplot as plt
+
+    fig, (heat, hist) = plt.subplots(2, 1, figsize=(12, 8))
+    rows = [a.free_fraction(width) for a in arenas]
+    im = heat.imshow(rows, aspect="auto", cmap="magma_r", vmin=0, vmax=1,
+                     interpolation="nearest")
+    heat.set_title("free fraction across each arena's heap")
+    heat.set_xlabel("position in heap (heap_start .. heap_end)")
+    heat.set_ylabel("arena")
+    heat.set_yticks(range(len(arenas)))
+    heat.set_yticklabels([a.index for a in arenas])
+    fig.colorbar(im, ax=heat)
+
+    sizes = [s for a in arenas for s in a.free_extents()]
+    hist_all = log2_histogram(sizes)
+    buckets = sorted(hist_all)
+    hist.bar([human(1 << b) for b in buckets], [hist_all[b] for b in buckets])
+    hist.set_title("free extents by size (all arenas)")
+    hist.set_ylabel("count")
+    hist.tick_params(axis="x", labelrotation=45)
+
+    fig.tight_layout()
+    fig.savefig(path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="heap map written by heap_map_dump()")
+    parser.add_argument("--width", type=int, default=64,
+                        help="number of columns in the heatmap")
+    parser.add_argument("--png", help="also render the heatmap to this file")
+    args = parser.parse_args()
+
+    arenas = read_map(args.map)
+    for arena in arenas:
+        report(arena, args.width)
+
+    if args.png:
+        render_png(arenas, args.width * 4, args.png)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,287 @@
+#!/usr/bin/env python3
+"""Analyzes a recorded allocation trace and recommends allocator settings.
+
+A trace is a text file with one event per line:
+
+    a <thread> <ptr> <size> [<time>]    allocation of <size> bytes at <ptr>
+    f <thread> <ptr> [<time>]           free of <ptr>
+
+<ptr> is hex, <time> is any increasing number (e.g. nanoseconds). When
+times are missing, the event number is used instead. Lines starting with
+'#' are ignored. One way to record a trace from an unmodified binary:
+
+    bpftrace -e '
+      uprobe:./a.out:arena_cached_malloc { @size[tid] = arg0; }
+      uretprobe:./a.out:arena_cached_malloc
+        { printf("a %d %x %d %d\\n", tid, retval, @size[tid], nsecs); }
+      uprobe:./a.out:arena_cached_free
+        { printf("f %d %x %d\\n", tid, arg0, nsecs); }' > trace.txt
+
+The report covers size histograms, object lifetimes, how many frees
+happen on a different thread than the allocation, and peak live bytes.
+From those, it recommends seglist size-class boundaries, the thread
+cache limits (by replaying the trace through a model of thread_cache.c)
+and an arena count.
+
+usage: trace_analyze.py [--classes N] trace.txt
+"""
+
+import argparse
+import bisect
+import collections
+import sys
+
+WSIZE = 8
+DSIZE = 16
+
+# candidate thread cache limits tried by the cache replay.
+CACHE_ENTRY_CANDIDATES = (2, 4, 8, 16, 32)
+CACHE_SIZE_CANDIDATES = (64 << 10, 256 << 10, 1 << 20, 4 << 20)
+
+
+def block_size(size):
+    """Block size the allocator uses for a request (see _malloc)."""
+    size += WSIZE
+    if size <= DSIZE:
+        return 2 * DSIZE
+    return DSIZE * ((size + DSIZE - 1) // DSIZE)
+
+
+class Alloc:
+    __slots__ = ("thread", "size", "block", "time", "clock")
+
+    def __init__(self, thread, size, time, clock):
+        self.thread = thread
+        self.size = size
+        self.block = block_size(size)
+        self.time = time
+        self.clock = clock
+
+
+def read_trace(path):
+    """Yields (op, thread, ptr, size, time) tuples."""
+    with open(path) as f:
+        for n, line in enumerate(f):
+            fields = line.split()
+            if not fields or fields[0].startswith("#"):
+                continue
+            try:
+                if fields[0] == "a":
+                    time = float(fields[4]) if len(fields) > 4 else n
+                    yield "a", fields[1], int(fields[2], 16), int(fields[3]), time
+                elif fields[0] == "f":
+                    time = float(fields[3]) if len(fields) > 3 else n
+                    yield "f", fields[1], int(fields[2], 16), 0, time
+            except (IndexError, ValueError):
+                sys.exit("%s:%d: malformed event: %s" % (path, n + 1, line.strip()))
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0
+    i = min(len(sorted_values) - 1, int(p / 100.0 * len(sorted_values)))
+    return sorted_values[i]
+
+
+def human(n):
+    for unit in ("B", "KB", "MB", "GB"):
+        if n < 1024:
+            return "%d %s" % (n, unit)
+        n //= 1024
+    return "%d TB" % n
+
+
+class Analysis:
+    def __init__(self):
+        self.live = {}
+        self.sizes = []
+        self.lifetimes = []
+        self.lifetime_bytes = []
+        self.frees = 0
+        self.cross_thread_frees = 0
+        self.unmatched_frees = 0
+        self.live_bytes = 0
+        self.peak_live_bytes = 0
+        # bytes allocated so far; lifetimes are also measured in this
+        # clock, which doesn't depend on how fast the program ran.
+        self.clock = 0
+        self.threads = {}
+        # (op, thread, block size) in trace order, for the cache replay.
+        self.events = []
+
+    def add(self, op, thread, ptr, size, time):
+        first, _ = self.threads.get(thread, (time, time))
+        self.threads[thread] = (first, time)
+
+        if op == "a":
+            obj = Alloc(thread, size, time, self.clock)
+            self.clock += obj.block
+            self.live[ptr] = obj
+            self.sizes.append(size)
+            self.live_bytes += obj.block
+            self.peak_live_bytes = max(self.peak_live_bytes, self.live_bytes)
+            self.events.append(("a", thread, obj.block))
+            return
+
+        obj = self.live.pop(ptr, None)
+        if obj is None:
+            self.unmatched_frees += 1
+            return
+        self.frees += 1
+        if obj.thread != thread:
+            self.cross_thread_frees += 1
+        self.live_bytes -= obj.block
+        self.lifetimes.append(time - obj.time)
+        self.lifetime_bytes.append(self.clock - obj.clock)
+        self.events.append(("f", thread, obj.block))
+
+    def peak_concurrent_threads(self):
+        """Most threads whose [first, last] event spans overlap."""
+        edges = []
+        for first, last in self.threads.values():
+            edges.append((first, 1))
+            edges.append((last, -1))
+        edges.sort(key=lambda e: (e[0], -e[1]))
+        active = peak = 0
+        for _, delta in edges:
+            active += delta
+            peak = max(peak, active)
+        return peak
+
+
+def replay_cache(events, max_entries, max_size):
+    """Hit rate of a per-thread cache modelled on thread_cache.c: frees
+    go into the freeing thread's cache if there is room, and
+    allocations take the first cached block that is large enough."""
+    caches = collections.defaultdict(list)
+    totals = collections.defaultdict(int)
+    hits = allocs = 0
+    for op, thread, size in events:
+        cache = caches[thread]
+        if op == "a":
+            allocs += 1
+            for i, cached in enumerate(cache):
+                if cached >= size:
+                    hits += 1
+                    totals[thread] -= cached
+                    del cache[i]
+                    break
+        elif len(cache) < max_entries and totals[thread] + size <= max_size:
+            cache.append(size)
+            totals[thread] += size
+    return hits / allocs if allocs else 0.0
+
+
+def recommend_classes(blocks, count):
+    """Class boundaries that split the allocations into roughly equal
+    shares, rounded to the 16-byte alignment."""
+    bounds = []
+    for i in range(1, count):
+        b = percentile(blocks, 100.0 * i / count)
+        b = DSIZE * ((b + DSIZE - 1) // DSIZE)
+        # nothing is smaller than the minimum block, so a boundary
+        # there would leave the first class empty.
+        if b > 2 * DSIZE and (not bounds or b > bounds[-1]):
+            bounds.append(b)
+    return bounds
+
+
+def print_histogram(title, values, label=human):
+    hist = collections.Counter(max(v, 1).bit_length() - 1 for v in values)
+    if not hist:
+        return
+    print(title)
+    top = max(hist.values())
+    for bucket in sorted(hist):
+        bar = "#" * max(1, hist[bucket] * 40 // top)
+        print("  %10s+ %8d %s" % (label(1 << bucket), hist[bucket], bar))
+
+
+def report(a, num_classes):
+    allocs = len(a.sizes)
+    print("%d allocations, %d frees (%d unmatched), %d threads" %
+          (allocs, a.frees, a.unmatched_frees, len(a.threads)))
+    if not allocs:
+        return
+
+    print_histogram("request sizes:", a.sizes)
+    print()
+
+    life = sorted(a.lifetimes)
+    life_bytes = sorted(a.lifetime_bytes)
+    if life:
+        print("lifetimes (trace time):        p50 %g  p90 %g  p99 %g  max %g" %
+              (percentile(life, 50), percentile(life, 90),
+               percentile(life, 99), life[-1]))
+        print("lifetimes (bytes allocated):   p50 %s  p90 %s  p99 %s" %
+              (human(percentile(life_bytes, 50)), human(percentile(life_bytes, 90)),
+               human(percentile(life_bytes, 99))))
+        print_histogram("lifetimes in bytes allocated meanwhile:", life_bytes)
+    print("never freed: %d objects, %s" %
+          (len(a.live), human(sum(o.block for o in a.live.values()))))
+    if a.frees:
+        print("cross-thread frees: %.1f%%" % (100.0 * a.cross_thread_frees / a.frees))
+    print("peak live bytes: %s" % human(a.peak_live_bytes))
+    print()
+
+    blocks = sorted(block_size(s) for s in a.sizes)
+    classes = recommend_classes(blocks, num_classes)
+    print("recommended size-class boundaries (block bytes, %d classes):" %
+          (len(classes) + 1))
+    print("  " + ", ".join(str(b) for b in classes))
+    current = [64 << k for k in range(num_classes - 1)]
+    shares = collections.Counter(bisect.bisect_right(current, b) for b in blocks)
+    busiest = max(shares.values()) * 100.0 / allocs
+    print("  (with the current power-of-two classes, the busiest class "
+          "holds %.0f%% of allocations)" % busiest)
+    print()
+
+    print("thread cache replay (hit rate):")
+    print("  %10s" % "entries" + "".join("%10s" % human(s) for s in CACHE_SIZE_CANDIDATES))
+    results = {}
+    for entries in CACHE_ENTRY_CANDIDATES:
+        row = []
+        for size in CACHE_SIZE_CANDIDATES:
+            rate = replay_cache(a.events, entries, size)
+            results[(entries, size)] = rate
+            row.append("%9.1f%%" % (100 * rate))
+        print("  %10d" % entries + "".join(row))
+
+    # the smallest cache within a point of the best one.
+    best = max(results.values())
+    entries, size = min((k for k, r in results.items() if r >= best - 0.01),
+                        key=lambda k: (k[0] * k[1], k[0]))
+    print()
+
+    concurrent = a.peak_concurrent_threads()
+    arenas = max(1, 2 * concurrent)
+    if a.frees and a.cross_thread_frees * 10 > a.frees:
+        # cross-thread frees lock the owning arena from another thread,
+        # so spreading allocations out further reduces collisions.
+        arenas *= 2
+
+    print("recommendations:")
+    print("  cache_max_entries  %d" % entries)
+    print("  cache_max_size     %s" % human(size))
+    print("  num_arenas         %d  (peak %d concurrently active threads)" %
+          (arenas, concurrent))
+    print()
+    print("  PMALLOC_CONF=\"cache_max_entries:%d,cache_max_size:%d,num_arenas:%d\"" %
+          (entries, size, arenas))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("trace", help="allocation trace (see above)")
+    parser.add_argument("--classes", type=int, default=15,
+                        help="number of size classes to recommend (maxlists)")
+    args = parser.parse_args()
+
+    analysis = Analysis()
+    for event in read_trace(args.trace):
+        analysis.add(*event)
+    report(analysis, args.classes)
+
+
+if __name__ == "__main__":
+    main()